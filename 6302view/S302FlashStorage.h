@@ -0,0 +1,53 @@
+/* Reach out to almonds@mit.edu or jodalyst@mit.edu for help */
+
+#ifndef _S302FlashStorage_H_
+#define _S302FlashStorage_H_
+
+#if !defined (ESP32) && !defined (ESP8266)
+#error "Flash storage is only available for the ESP32 or ESP8266"
+#endif
+
+#include "S302Storage.h"
+#include <FS.h>
+
+/* Flash storage
+
+   Keeps the flight recorder's capture in a file on LittleFS or SPIFFS.
+   Mount the filesystem yourself first, e.g.
+
+      LittleFS.begin(true);
+      S302FlashStorage flash(LittleFS, "/run.bin");
+
+   A new capture replaces the file. */
+
+class S302FlashStorage {
+
+   public:
+
+      S302FlashStorage(fs::FS& fs, const char* path = "/6302.bin")
+         : _fs(fs), _path(path) {}
+
+      bool begin() {
+         if( _r ) _r.close();
+         _w = _fs.open(_path, "w");
+         return (bool)_w;
+      }
+      size_t write(const uint8_t* buf, size_t len) {
+         return _w? _w.write(buf, len) : 0;
+      }
+      void end() { if( _w ) _w.close(); }
+      size_t read(uint32_t pos, uint8_t* buf, size_t len) {
+         if( !_r && !(_r = _fs.open(_path, "r")) ) return 0;
+         if( _r.position() != pos ) _r.seek(pos);
+         return _r.read(buf, len);
+      }
+
+   protected:
+
+      fs::FS&     _fs;
+      const char* _path;
+      fs::File    _w, _r; // (writing a capture, reading it back)
+
+};
+
+#endif
@@ -0,0 +1,97 @@
+/* Reach out to almonds@mit.edu or jodalyst@mit.edu for help */
+
+#ifndef _S302Storage_H_
+#define _S302Storage_H_
+
+#include <Arduino.h>
+
+/* Storage policies
+
+   Where the flight recorder keeps its capture. A storage is any class with
+   these four members:
+
+      bool     begin();  // start a new, empty capture
+      size_t   write(const uint8_t* buf, size_t len); // append
+      void     end();    // the capture is complete
+      size_t   read(uint32_t pos, uint8_t* buf, size_t len); // 0 past the end
+
+   They are handed to `CommManager::addRecorder`, which resolves the calls
+   through the table of functions in `S302StoragePolicy<T>`, as for
+   transports. */
+
+struct S302StorageOps {
+   bool     (*begin)(void* self);
+   size_t   (*write)(void* self, const uint8_t* buf, size_t len);
+   void     (*end)(void* self);
+   size_t   (*read)(void* self, uint32_t pos, uint8_t* buf, size_t len);
+};
+
+template <class T>
+struct S302StoragePolicy {
+   static bool begin(void* self) {
+      return ((T*)self)->begin();
+   }
+   static size_t write(void* self, const uint8_t* buf, size_t len) {
+      return ((T*)self)->write(buf, len);
+   }
+   static void end(void* self) {
+      ((T*)self)->end();
+   }
+   static size_t read(void* self, uint32_t pos, uint8_t* buf, size_t len) {
+      return ((T*)self)->read(pos, buf, len);
+   }
+   static const S302StorageOps ops;
+};
+
+template <class T>
+const S302StorageOps S302StoragePolicy<T>::ops = {
+   S302StoragePolicy<T>::begin,
+   S302StoragePolicy<T>::write,
+   S302StoragePolicy<T>::end,
+   S302StoragePolicy<T>::read
+};
+
+/* Plain file
+
+   For host builds and experiments: the capture goes to a file through
+   stdio. (See S302FlashStorage.h for LittleFS or SPIFFS on the ESPs.) */
+
+#if !defined ARDUINO
+
+#include <stdio.h>
+
+class S302StdioStorage {
+
+   public:
+
+      S302StdioStorage(const char* path = "6302.bin")
+         : _path(path), _f(NULL) {}
+      ~S302StdioStorage() { if( _f ) fclose(_f); }
+
+      bool begin() {
+         if( _f ) fclose(_f);
+         _f = fopen(_path, "w+b");
+         return _f != NULL;
+      }
+      size_t write(const uint8_t* buf, size_t len) {
+         if( !_f ) return 0;
+         fseek(_f, 0, SEEK_END);
+         return fwrite(buf, 1, len, _f);
+      }
+      void end() { if( _f ) fflush(_f); }
+      size_t read(uint32_t pos, uint8_t* buf, size_t len) {
+         if( !_f && !(_f = fopen(_path, "r+b")) ) return 0;
+         fseek(_f, pos, SEEK_SET);
+         return fread(buf, 1, len, _f);
+      }
+
+   protected:
+
+      const char* _path;
+      FILE*       _f;
+
+};
+
+#endif
+
+#endif
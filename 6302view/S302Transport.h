@@ -0,0 +1,260 @@
+/* Reach out to almonds@mit.edu or jodalyst@mit.edu for help */
+
+#ifndef _S302Transport_H_
+#define _S302Transport_H_
+
+#include <Arduino.h>
+
+/* Transport policies
+
+   A transport is any class with these five members:
+
+      size_t write(const uint8_t* buf, size_t len);
+      int    available();
+      int    read();
+      void   loop();
+      int    availableForWrite(); // free room in the transmit queue,
+                                  // or -1 if the transport can't tell
+
+   They are handed to `CommManager::addTransport`, which keeps a pointer
+   to the object and to `S302Policy<T>::ops` below, a table of functions
+   for its type. So no base class is needed, but each call is an indirect
+   one through the table, like a virtual call. The room for each
+   transport (its transmit queue, recordings and change-only state) is
+   reserved in CommManager for all MAX_TRANSPORTS, attached or not. */
+
+struct S302Ops {
+   size_t (*write)(void* self, const uint8_t* buf, size_t len);
+   int    (*available)(void* self);
+   int    (*read)(void* self);
+   void   (*loop)(void* self);
+   int    (*availableForWrite)(void* self);
+};
+
+template <class T>
+struct S302Policy {
+   static size_t write(void* self, const uint8_t* buf, size_t len) {
+      return ((T*)self)->write(buf, len);
+   }
+   static int available(void* self) {
+      return ((T*)self)->available();
+   }
+   static int read(void* self) {
+      return ((T*)self)->read();
+   }
+   static void loop(void* self) {
+      ((T*)self)->loop();
+   }
+   static int availableForWrite(void* self) {
+      return ((T*)self)->availableForWrite();
+   }
+   static const S302Ops ops;
+};
+
+template <class T>
+const S302Ops S302Policy<T>::ops = {
+   S302Policy<T>::write,
+   S302Policy<T>::available,
+   S302Policy<T>::read,
+   S302Policy<T>::loop,
+   S302Policy<T>::availableForWrite
+};
+
+/* Serial
+
+   Wraps anything derived from `Stream` (HardwareSerial, the Teensy's
+   usb_serial_class, the ESP32-C3's HWCDC, ...). Call `begin` on the port
+   yourself before attaching it. */
+
+class S302SerialTransport {
+
+   public:
+
+      S302SerialTransport(Stream* s = NULL) : _s(s) {}
+
+      size_t write(const uint8_t* buf, size_t len) { return _s->write(buf, len); }
+      int    available()                            { return _s->available(); }
+      int    read()                                 { return _s->read(); }
+      void   loop()                                 {}
+      int    availableForWrite()                    { return _s->availableForWrite(); }
+
+   protected:
+
+      Stream* _s;
+
+};
+
+/* Loopback
+
+   Two ring buffers standing in for a wire, for host builds and
+   experiments. `inject` queues bytes for the device to read, `drain`
+   collects what the device wrote. Bytes that don't fit are dropped.
+
+   `throttle` makes the device side behave like a slow link: a transmit
+   queue of `S302_LOOPBACK_LEN` bytes emptying at the given rate, which
+   `write` won't overfill and `availableForWrite` reports on. */
+
+#ifndef S302_LOOPBACK_LEN
+#define S302_LOOPBACK_LEN 512
+#endif
+
+class S302LoopbackTransport {
+
+   public:
+
+      S302LoopbackTransport() : _in_head(0), _in_tail(0),
+                                _out_head(0), _out_tail(0),
+                                _bps(0), _queued(0), _leak_timer(0) {}
+
+      /* device side */
+
+      size_t write(const uint8_t* buf, size_t len) {
+         if( _bps ) {
+            _leak();
+            if( len > S302_LOOPBACK_LEN - _queued )
+               len = S302_LOOPBACK_LEN - _queued;
+            _queued += len;
+         }
+         size_t i = 0;
+         while( i < len && _push(_out, _out_head, _out_tail, buf[i]) )
+            i++;
+         return len;
+      }
+      int available() {
+         return (_in_head - _in_tail + S302_LOOPBACK_LEN) % S302_LOOPBACK_LEN;
+      }
+      int read() {
+         if( _in_head == _in_tail )
+            return -1;
+         uint8_t c = _in[_in_tail];
+         _in_tail = (_in_tail + 1) % S302_LOOPBACK_LEN;
+         return c;
+      }
+      void loop() {}
+      int availableForWrite() {
+         if( !_bps )
+            return S302_LOOPBACK_LEN - 1 -
+               (_out_head - _out_tail + S302_LOOPBACK_LEN) % S302_LOOPBACK_LEN;
+         _leak();
+         return S302_LOOPBACK_LEN - _queued;
+      }
+
+      /* host side */
+
+      void throttle(uint32_t bytes_per_second) {
+         _bps = bytes_per_second;
+         _queued = 0;
+         _leak_timer = micros();
+      }
+
+      size_t inject(const char* msg) {
+         size_t i = 0;
+         while( msg[i] && _push(_in, _in_head, _in_tail, msg[i]) )
+            i++;
+         return i;
+      }
+      size_t drain(uint8_t* buf, size_t len) {
+         size_t i = 0;
+         while( i < len && _out_tail != _out_head ) {
+            buf[i++] = _out[_out_tail];
+            _out_tail = (_out_tail + 1) % S302_LOOPBACK_LEN;
+         }
+         return i;
+      }
+
+   protected:
+
+      uint8_t  _in[S302_LOOPBACK_LEN];
+      uint8_t  _out[S302_LOOPBACK_LEN];
+      uint16_t _in_head, _in_tail;
+      uint16_t _out_head, _out_tail;
+
+      uint32_t _bps, _queued, _leak_timer;
+
+      void _leak() {
+         // (whole bytes only, the remainder carries over)
+         uint32_t sent = (uint64_t)(micros() - _leak_timer) * _bps / 1000000;
+         if( !sent )
+            return;
+         _leak_timer += (uint64_t)sent * 1000000 / _bps;
+         _queued = sent < _queued? _queued - sent : 0;
+      }
+
+      static bool _push(uint8_t* ring, uint16_t& head, uint16_t tail, uint8_t c) {
+         uint16_t next = (head + 1) % S302_LOOPBACK_LEN;
+         if( next == tail )
+            return false; // full
+         ring[head] = c;
+         head = next;
+         return true;
+      }
+
+};
+
+/* Pseudo-terminal
+
+   The reliable transport for a host build: `begin` opens a pty, and
+   `path` names its other end for `local_server.py --serial PATH` (or any
+   terminal program). Unlike the host's Serial stand-in, it reads, so the
+   build string, controls and pings work. A write the pty has no room for
+   is dropped, as over a serial port nobody is reading. */
+
+#if !defined ARDUINO
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+class S302PtyTransport {
+
+   public:
+
+      S302PtyTransport() : _fd(-1), _peer(-1), _rx_len(0), _rx_pos(0) {}
+      ~S302PtyTransport() { if( _fd >= 0 ) close(_fd); if( _peer >= 0 ) close(_peer); }
+
+      bool begin() {
+         _fd = posix_openpt(O_RDWR | O_NOCTTY);
+         if( _fd < 0 || grantpt(_fd) || unlockpt(_fd) )
+            return false;
+         fcntl(_fd, F_SETFL, O_NONBLOCK);
+         // (hold the other end open, raw, so nothing echoes or is lost
+         // before the bridge opens it)
+         _peer = open(ptsname(_fd), O_RDWR | O_NOCTTY);
+         if( _peer < 0 )
+            return false;
+         termios t;
+         tcgetattr(_peer, &t);
+         cfmakeraw(&t);
+         tcsetattr(_peer, TCSANOW, &t);
+         return true;
+      }
+      const char* path() { return _fd < 0? NULL : ptsname(_fd); }
+
+      size_t write(const uint8_t* buf, size_t len) {
+         ssize_t n = ::write(_fd, buf, len);
+         return n > 0? n : 0;
+      }
+      int available() {
+         if( _rx_pos == _rx_len ) {
+            ssize_t n = ::read(_fd, _rx, sizeof(_rx));
+            _rx_len = n > 0? n : 0;
+            _rx_pos = 0;
+         }
+         return _rx_len - _rx_pos;
+      }
+      int read() { return available()? _rx[_rx_pos++] : -1; }
+      void loop() {}
+      int availableForWrite() { return -1; }
+
+   protected:
+
+      int     _fd, _peer;
+      uint8_t _rx[64];
+      size_t  _rx_len, _rx_pos;
+
+};
+
+#endif
+
+#endif
@@ -0,0 +1,215 @@
+/* Reach out to almonds@mit.edu or jodalyst@mit.edu for help */
+
+#ifndef _S302Udp_H_
+#define _S302Udp_H_
+
+#include "S302Transport.h"
+
+#ifndef S302_UDP_PORT
+#define S302_UDP_PORT 6303
+#endif
+
+#ifndef S302_UDP_LEN
+#define S302_UDP_LEN 1460 // longest datagram, sequence number included
+#endif
+
+#define S302_UDP_ENDPOINTS 4
+#define S302_UDP_TIMEOUT   5000000 // (us) to keep an endpoint unheard from
+
+/* UDP transport
+
+   For live plots that would rather lose a report than wait for it. All a
+   step writes goes out at its `loop` as one datagram, to every subscribed
+   endpoint: a sequence number (uint32, little-endian), then the frames. A
+   datagram longer than S302_UDP_LEN isn't sent at all (see `dropped`), so
+   keep reports on this transport short.
+
+   Nothing is ever read from it. Build strings, controls and pings stay on
+   a reliable transport, added with the same reporters and a report period
+   of S302_NO_REPORTS so it describes them without also reporting them:
+
+      cm.addTransport(usb, S302_NO_REPORTS);
+      cm.addTransport(udp);
+
+   Endpoints subscribe by sending "S" to the port, at least once every
+   S302_UDP_TIMEOUT microseconds, and leave with "U". The bridge does so
+   for the GUI with `local_server.py --udp`.
+
+   `UDP` is WiFiUDP on the ESP32 or ESP8266 (call `begin` once on the
+   network), or S302PosixUdp below on a host. */
+
+#if defined ARDUINO
+template <class UDP, class IP = IPAddress>
+#else
+template <class UDP, class IP = uint32_t>
+#endif
+class S302UdpTransport {
+
+   public:
+
+      S302UdpTransport(uint16_t port = S302_UDP_PORT)
+         : _port(port), _len(4), _overflow(false), _seq(0),
+           _dropped(0), _endpoints(0) {}
+
+      bool begin() { return _udp.begin(_port); } // (false: no socket)
+
+      size_t write(const uint8_t* buf, size_t len) {
+         if( _len + len > S302_UDP_LEN ) {
+            _overflow = true;
+            return 0;
+         }
+         memcpy(_packet + _len, buf, len);
+         _len += len;
+         return len;
+      }
+      int  available() { return 0; }
+      int  read()      { return -1; }
+      void loop()      { _listen(); _send(); }
+      int  availableForWrite() { return -1; } // (never waits)
+
+      uint32_t dropped()     { return _dropped; }
+      uint8_t  subscribers() { return _endpoints; }
+
+   protected:
+
+      UDP      _udp;
+      uint16_t _port;
+      uint8_t  _packet[S302_UDP_LEN];
+      uint16_t _len;
+      bool     _overflow;
+      uint32_t _seq, _dropped;
+
+      IP       _ips[S302_UDP_ENDPOINTS];
+      uint16_t _ports[S302_UDP_ENDPOINTS];
+      uint32_t _heard[S302_UDP_ENDPOINTS];
+      uint8_t  _endpoints;
+
+      void _listen() {
+         uint32_t now = micros();
+         while( _udp.parsePacket() > 0 ) {
+            int c = _udp.read();
+            IP ip = _udp.remoteIP();
+            uint16_t port = _udp.remotePort();
+            uint8_t i = 0;
+            while( i < _endpoints && !(_ips[i] == ip && _ports[i] == port) )
+               i++;
+            if( c == 'S' ) {
+               if( i == _endpoints ) {
+                  if( _endpoints == S302_UDP_ENDPOINTS )
+                     continue; // (full)
+                  _ips[i] = ip;
+                  _ports[i] = port;
+                  _endpoints++;
+               }
+               _heard[i] = now;
+            } else if( c == 'U' && i < _endpoints ) {
+               _heard[i] = now - S302_UDP_TIMEOUT - 1;
+            }
+         }
+         // forget the quiet ones
+         for( uint8_t i = 0; i < _endpoints; )
+            if( now - _heard[i] > S302_UDP_TIMEOUT ) {
+               _endpoints--;
+               _ips[i] = _ips[_endpoints];
+               _ports[i] = _ports[_endpoints];
+               _heard[i] = _heard[_endpoints];
+            } else {
+               i++;
+            }
+      }
+
+      void _send() {
+         if( _len == 4 )
+            return; // (nothing this step)
+         if( _overflow ) {
+            _dropped++;
+         } else {
+            memcpy(_packet, &_seq, 4);
+            for( uint8_t i = 0; i < _endpoints; i++ ) {
+               _udp.beginPacket(_ips[i], _ports[i]);
+               _udp.write(_packet, _len);
+               _udp.endPacket();
+            }
+         }
+         _seq++; // (a gap tells the receiver what it missed)
+         _len = 4;
+         _overflow = false;
+      }
+
+};
+
+/* POSIX sockets
+
+   Enough of Arduino's UDP class for S302UdpTransport on a host, so the
+   path through `local_server.py --udp` can be tried over localhost:
+
+      S302UdpTransport<S302PosixUdp> udp; */
+
+#if !defined ARDUINO
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+class S302PosixUdp {
+
+   public:
+
+      S302PosixUdp() : _fd(-1), _tx_len(0), _rx_len(0), _rx_pos(0) {}
+      ~S302PosixUdp() { if( _fd >= 0 ) close(_fd); }
+
+      uint8_t begin(uint16_t port) {
+         _fd = socket(AF_INET, SOCK_DGRAM, 0);
+         if( _fd < 0 ) return 0;
+         fcntl(_fd, F_SETFL, O_NONBLOCK);
+         sockaddr_in at = {};
+         at.sin_family = AF_INET;
+         at.sin_addr.s_addr = htonl(INADDR_ANY);
+         at.sin_port = htons(port);
+         return bind(_fd, (sockaddr*)&at, sizeof(at)) == 0;
+      }
+
+      int beginPacket(uint32_t ip, uint16_t port) {
+         _to = sockaddr_in();
+         _to.sin_family = AF_INET;
+         _to.sin_addr.s_addr = ip; // (network order, as remoteIP gives it)
+         _to.sin_port = htons(port);
+         _tx_len = 0;
+         return 1;
+      }
+      size_t write(const uint8_t* buf, size_t len) {
+         if( len > sizeof(_tx) - _tx_len ) len = sizeof(_tx) - _tx_len;
+         memcpy(_tx + _tx_len, buf, len);
+         _tx_len += len;
+         return len;
+      }
+      int endPacket() {
+         return sendto(_fd, _tx, _tx_len, 0, (sockaddr*)&_to, sizeof(_to)) >= 0;
+      }
+
+      int parsePacket() {
+         socklen_t size = sizeof(_from);
+         ssize_t n = recvfrom(_fd, _rx, sizeof(_rx), 0, (sockaddr*)&_from, &size);
+         _rx_len = n > 0? n : 0;
+         _rx_pos = 0;
+         return _rx_len;
+      }
+      int read() { return _rx_pos < _rx_len? _rx[_rx_pos++] : -1; }
+      uint32_t remoteIP()   { return _from.sin_addr.s_addr; }
+      uint16_t remotePort() { return ntohs(_from.sin_port); }
+
+   protected:
+
+      int         _fd;
+      sockaddr_in _to, _from;
+      uint8_t     _tx[S302_UDP_LEN];
+      size_t      _tx_len;
+      uint8_t     _rx[64];
+      size_t      _rx_len, _rx_pos;
+
+};
+
+#endif
+
+#endif
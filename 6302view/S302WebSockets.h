@@ -0,0 +1,100 @@
+/* Reach out to almonds@mit.edu or jodalyst@mit.edu for help */
+
+#ifndef _S302WebSockets_H_
+#define _S302WebSockets_H_
+
+#if !defined (ESP32) && !defined (ESP8266) && \
+    !defined (PICO_W) && !defined (PICO_2_W)
+#error "WebSockets is only available for the ESP32 or ESP8266 or Pico W"
+#endif
+
+#include "S302Transport.h"
+
+#ifdef ESP8266
+#include <ESP8266WiFi.h>
+#else
+#include <WiFi.h>
+#endif
+#include <WebSocketsServer.h>
+
+#ifndef S302_PORT
+#define S302_PORT 80
+#endif
+
+#define S302_WS_RX_LEN 64
+
+/* WebSockets transport
+
+   Serves the GUI directly from the microcontroller. Connect to WiFi first,
+   then call `begin`, then hand it to `CommManager::addTransport`. Define
+   S302_VERBOSE before including this file to print connection events to
+   Serial, unless Serial is also a transport: the prints would land in the
+   middle of its reports. */
+
+class S302WebSocketsTransport {
+
+   public:
+
+      S302WebSocketsTransport(uint16_t port = S302_PORT)
+         : _wss(port), _rx_len(0), _rx_pos(0) {}
+
+      void begin() {
+         _wss.begin();
+         _wss.onEvent(std::bind(&S302WebSocketsTransport::_on_event, this,
+            std::placeholders::_1, std::placeholders::_2,
+            std::placeholders::_3, std::placeholders::_4));
+      }
+
+      size_t write(const uint8_t* buf, size_t len) {
+         _wss.broadcastBIN((uint8_t*)buf, len);
+         return len;
+      }
+      int available() { return _rx_len - _rx_pos; }
+      int read() {
+         if( _rx_pos >= _rx_len )
+            return -1;
+         return (uint8_t)_rx[_rx_pos++];
+      }
+      void loop() { _wss.loop(); }
+      int availableForWrite() { return -1; } // (unknown)
+
+   protected:
+
+      WebSocketsServer _wss;
+      char             _rx[S302_WS_RX_LEN];
+      uint8_t          _rx_len, _rx_pos;
+
+      void _on_event(uint8_t num, WStype_t type,
+                     uint8_t* payload, size_t length) {
+         switch(type) {
+#ifdef S302_VERBOSE
+            case WStype_DISCONNECTED: {
+               Serial.printf("[%u] Disconnected\n", num);
+            } break;
+            case WStype_CONNECTED: {
+               Serial.printf("[%u] Connected from %s\n",
+                  num, _wss.remoteIP(num).toString().c_str());
+            } break;
+#endif
+            case WStype_TEXT: {
+               if( payload[0] != '\0' ) {
+                  // (unread bytes from the last message are dropped)
+                  _rx_len = length < S302_WS_RX_LEN? length : S302_WS_RX_LEN;
+                  _rx_pos = 0;
+                  memcpy(_rx, payload, _rx_len);
+#ifdef S302_VERBOSE
+                  Serial.printf("[%u] Received: ", num);
+                  Serial.println((char*)payload);
+               } else {
+                  Serial.printf("[%u] Received empty message!\n", num);
+#endif
+               }
+            } break;
+
+            default: break;
+         }
+      }
+
+};
+
+#endif
@@ -10,34 +10,16 @@
 CommManager::CommManager(uint32_t sp, uint32_t rp) {
    _step_period = sp;
    _report_period = rp;
-#ifdef S302_WEBSOCKETS
-   _wss = WebSocketsServer(S302_PORT);
-#endif
    strcpy(_build_string, "\fB");
    _debug_string[0] = '\0';
+   // (the library's own work that can wait for the idle time)
+   addIdleJob(_build_job, this, S302_BUILD_BUDGET, S302_IDLE_PATIENCE);
+   addIdleJob(_debug_job, this, S302_DEBUG_BUDGET, S302_IDLE_PATIENCE);
 }
 
-/* :: connect( &Serial, baud ) 
-             ( "ssid", "p/w" ) */
+/* :: connect( "ssid", "p/w" ) */
 
-#ifdef S302_SERIAL
-#ifdef TEENSYDUINO
-void CommManager::connect(usb_serial_class* s, uint32_t baud)
-#elif defined(ARDUINO_USB_MODE)
-void CommManager::connect(HWCDC* s, uint32_t baud)
-#else
-void CommManager::connect(HardwareSerial* s, uint32_t baud)
-#endif
-{
-   _serial = s;
-   _baud = baud;
-   _serial->begin(baud);
-   while(!_serial);
-   // Serial tends to fill with garbage for the first half-second
-   delay(500);
-   while( _serial->available() )
-      _serial->read();
-#elif defined S302_WEBSOCKETS
+#ifdef S302_WEBSOCKETS
 void CommManager::connect(const char* ssid, const char* pw) {
    // Serial should be ready to go
    Serial.printf("Connecting to %s WiFi ", ssid);
@@ -54,9 +36,15 @@ void CommManager::connect(const char* ssid, const char* pw) {
    IPAddress ip = WiFi.localIP();
    Serial.printf("--> %d.%d.%d.%d:%d <--\n", ip[0], ip[1], ip[2], ip[3], S302_PORT);
    // Start the WebSocket server
-   _wss.begin();
-   _wss.onEvent(std::bind(&CommManager::_on_websocket_event, this, _1, _2, _3, _4));
+   _ws_link.begin();
+   addTransport(_ws_link);
+   connect();
+}
 #endif
+
+/* :: connect() */
+
+void CommManager::connect() {
 #ifdef ESP32
    _baton = xSemaphoreCreateMutex();
 #endif
@@ -69,9 +57,74 @@ void CommManager::connect(const char* ssid, const char* pw) {
 #ifdef ESP32
    _secondary_timer = micros();
 #endif
+   for( uint8_t link = 0; link < _total_links; link++ )
+      _links[link].report_timer = _links[link].tx_timer = micros();
    _ready = true;
 }
 
+/* :: _add_link( transport, ops, report period, reporters ) */
+
+bool CommManager::_add_link(void* self, const S302Ops* ops,
+                            uint32_t report_period, uint32_t reporters) {
+   if( _total_links >= MAX_TRANSPORTS )
+      return false;
+   if( !report_period )
+      report_period = _report_period;
+
+   // reporters already added must fit this link's report period too
+   for( uint8_t reporter = 0; reporter < _total_reporters; reporter++ )
+      if( (reporters & (1UL << reporter))
+      &&  _bursts[reporter] > (float)report_period / (float)_step_period )
+         return false;
+
+   S302Link& l = _links[_total_links++];
+   l.self = self;
+   l.ops = ops;
+   l.reporters = reporters;
+   l.report_period = report_period;
+   l.report_timer = micros();
+   l.rx_len = 0;
+   l.rp_max = 0;
+   l.keep = 255;
+   l.calm = 0;
+   l.calm_needed = S302_CALM_REPORTS;
+   l.room_max = 0;
+   l.waiting = 0;
+   l.queued = 0;
+   l.capacity = 0;
+   l.tx_bytes = 0;
+   l.tx_timer = micros();
+   l.bps = 0;
+   l.unsent = S302_ALL_REPORTERS;
+   l.build_due = false;
+#if !defined S302_UNO
+   l.tx_head = l.tx_tail = 0;
+   l.stalled = false;
+   l.tx_room_max = l.tx_pending = 0;
+#endif
+
+   return true;
+}
+
+/* :: adapt( transport, report period range ) */
+
+bool CommManager::adapt(uint8_t transport,
+                        uint32_t rp_min, uint32_t rp_max) {
+   if( transport >= _total_links
+   ||  rp_min < _step_period
+   ||  rp_min > rp_max )
+      return false;
+
+   S302Link& l = _links[transport];
+   if( l.report_period == S302_NO_REPORTS )
+      return false;
+   l.rp_min = rp_min;
+   l.rp_max = rp_max;
+   l.report_period = constrain(l.report_period, rp_min, rp_max);
+
+   return true;
+}
+
 /* :: pinToCore( coreID ) */
 
 #if defined ESP32
@@ -207,18 +260,17 @@ bool CommManager::addSlider(float* linker, const char* title,
 
 /* :: addPlot( link, title, yrange ) */
 
-bool CommManager::addPlot(float* linker, const char* title,
-                          float yrange_min, float yrange_max,
-                          uint8_t steps_displayed,
-                          uint8_t burst,
-                          uint8_t num_plots) {
-   if( _total_reporters >= MAX_REPORTERS
-   ||  burst == 0
-   ||  burst > (float)_report_period / (float)_step_period )
+bool CommManager::_add_plot(void* linker, uint8_t type, const char* title,
+                            float yrange_min, float yrange_max,
+                            uint8_t steps_displayed,
+                            uint8_t burst,
+                            uint8_t num_plots) {
+   if( !_can_report(burst, type) )
       return false;
 
-   _reporters[_total_reporters] = linker;
-   _bursts[_total_reporters++] = burst;
+   _add_reporter(linker, type, burst);
+   char type_name[8];
+   _type_name(type, type_name);
 #ifdef S302_UNO
    strcpy(_buf, "P\r");
    strncat(_buf, title, MAX_TITLE_LEN);
@@ -238,81 +290,194 @@ bool CommManager::addPlot(float* linker, const char* title,
    itoa(num_plots, _tmp, 10);
    strcat(_buf, _tmp);
    strcat(_buf, "\r");
+   strcat(_buf, type_name);
+   strcat(_buf, "\r");
 #else
-   sprintf(_buf, "P\r%.*s\r%f\r%f\r%d\r%d\r%d\r",
+   sprintf(_buf, "P\r%.*s\r%f\r%f\r%d\r%d\r%d\r%s\r",
       MAX_TITLE_LEN, title, yrange_min, yrange_max,
-      steps_displayed, burst, num_plots);
+      steps_displayed, burst, num_plots, type_name);
 #endif
+   _spans[_total_reporters][0] = strlen(_build_string);
    strcat(_build_string, _buf);
+   _spans[_total_reporters++][1] = strlen(_build_string);
    
    return true;
 }
 
 /* :: addNumber( link, title ) */
 
-bool CommManager::addNumber(float* linker,
-                            const char* title,
-                            uint8_t burst) {
-   if( _total_reporters >= MAX_REPORTERS
-   ||  burst == 0
-   ||  burst > (float)_report_period / (float)_step_period )
+bool CommManager::_add_number(void* linker, uint8_t type,
+                              const char* title,
+                              uint8_t burst) {
+   if( !_can_report(burst, type) )
       return false;
       
-   _reporters[_total_reporters] = linker;
-   _bursts[_total_reporters++] = burst;
+   _add_reporter(linker, type, burst);
+   char type_name[8];
+   _type_name(type, type_name);
 #ifdef S302_UNO
    strcpy(_buf, "N\r");
    strncat(_buf, title, MAX_TITLE_LEN);
    strcat(_buf, "\r");
    itoa(burst, _tmp, 10);
    strcat(_buf, _tmp);
-   strcat(_buf, "\rfloat\r");
+   strcat(_buf, "\r");
+   strcat(_buf, type_name);
+   strcat(_buf, "\r");
 #else
-   sprintf(_buf, "N\r%.*s\r%d\rfloat\r",
-      MAX_TITLE_LEN, title, burst);
+   sprintf(_buf, "N\r%.*s\r%d\r%s\r",
+      MAX_TITLE_LEN, title, burst, type_name);
 #endif
+   _spans[_total_reporters][0] = strlen(_build_string);
    strcat(_build_string, _buf);
+   _spans[_total_reporters++][1] = strlen(_build_string);
    
    return true;
 }
 
-bool CommManager::addNumber(int32_t* linker,
-                            const char* title,
-                            uint8_t burst) {
-   if( _total_reporters >= MAX_REPORTERS
-   ||  burst == 0
-   ||  burst > (float)_report_period / (float)_step_period )
-      return false;
+/* :: deadband( link, deadband, max interval ) */
+
+bool CommManager::deadband(const void* linker, float deadband,
+                           uint32_t max_interval) {
+   for( uint8_t reporter = 0; reporter < _total_reporters; reporter++ ) {
+      if( _reporters[reporter] != linker )
+         continue;
+      if( !_change_only[reporter] ) {
+         if( _total_change_only >= MAX_CHANGE_ONLY )
+            return false; // (no more room)
+         _change_only[reporter] = ++_total_change_only;
+      }
+      uint8_t c = _change_only[reporter] - 1;
+      _deadbands[c] = deadband;
+      _max_intervals[c] = max_interval;
+      return true;
+   }
+   return false;
+}
 
-   _reporters[_total_reporters] = (float*)linker;
-   _bursts[_total_reporters++] = burst;
-#ifdef S302_UNO
-   strcpy(_buf, "N\r");
-   strncat(_buf, title, MAX_TITLE_LEN);
-   strcat(_buf, "\r");
-   itoa(burst, _tmp, 10);
-   strcat(_buf, _tmp);
-   strcat(_buf, "\rint\r");
+/* :: snapshot( link ) */
+
+bool CommManager::snapshot(const void* linker) {
+   for( uint8_t reporter = 0; reporter < _total_reporters; reporter++ ) {
+      if( _reporters[reporter] != linker )
+         continue;
+      _grouped |= 1UL << reporter;
+      return true;
+   }
+   return false;
+}
+
+/* :: beginUpdate() */
+
+void CommManager::beginUpdate() {
+   _seq++; // odd: keep out
+   FENCE
+}
+
+/* :: endUpdate() */
+
+void CommManager::endUpdate() {
+   FENCE
+   _seq++; // even: all yours
+}
+
+/* :: addRecorder( storage, reporters, flush budget ) */
+
+#if !defined S302_UNO
+bool CommManager::_add_recorder(void* self, const S302StorageOps* ops,
+                                uint32_t reporters, uint32_t flush_budget) {
+   if( _store || _total_jobs + 2 > MAX_IDLE_JOBS )
+      return false; // (one recorder, and room for its jobs)
+   _store = self;
+   _store_ops = ops;
+   _rec_reporters = reporters;
+#if defined ESP32
+   // (pages go to storage from their own task, never from step)
+   (void)flush_budget;
+   xTaskCreate(_rec_walk, "6302rec", 4096, this, 1, &_rec_task);
 #else
-   sprintf(_buf, "N\r%.*s\r%d\rint\r",
-      MAX_TITLE_LEN, title, burst);
+   // (or in the idle time, when there's room for a page)
+   addIdleJob(_flush_job, this, flush_budget);
 #endif
-   strcat(_build_string, _buf);
+   addIdleJob(_download_job, this, S302_DOWNLOAD_BUDGET);
+   return true;
+}
+
+/* :: record( on ) */
+
+bool CommManager::record(bool on) {
+   if( !_store || on == _rec_on )
+      return false;
+   if( !on ) {
+      _rec_on = false; // (step hands over the last page)
+      return true;
+   }
+
+   // the last capture must be all written out first
+   if( _rec_active || _rec_ending || _page_full[0] || _page_full[1]
+   ||  _download_to
+   ||  !_store_ops->begin(_store) )
+      return false;
+
+   // Header: "S302", the step period, how many reporters, then the type
+   // and title ('\0' ended) of each. Records follow: micros(), then the
+   // values at their own widths.
+   uint8_t n = 0;
+   for( uint8_t reporter = 0; reporter < _total_reporters; reporter++ )
+      if( _rec_reporters & (1UL << reporter) )
+         n++;
+   _store_ops->write(_store, (const uint8_t*)"S302", 4);
+   _store_ops->write(_store, (const uint8_t*)&_step_period, 4);
+   _store_ops->write(_store, &n, 1);
+   _rec_len = 4;
+   for( uint8_t reporter = 0; reporter < _total_reporters; reporter++ ) {
+      if( !(_rec_reporters & (1UL << reporter)) )
+         continue;
+      // (the title is the build string's second field)
+      const char* title = _build_string + _spans[reporter][0] + 2;
+      _store_ops->write(_store, &_types[reporter], 1);
+      _store_ops->write(_store, (const uint8_t*)title,
+                        strchr(title, '\r') - title);
+      _store_ops->write(_store, (const uint8_t*)"", 1);
+      _rec_len += _types[reporter] & 0x0F;
+   }
 
+   _page = _page_next = 0;
+   _page_len[0] = _page_len[1] = 0;
+   _rec_dropped = 0;
+   FENCE
+   _rec_on = true;
    return true;
 }
 
+/* :: recordsDropped() */
+
+uint32_t CommManager::recordsDropped() {
+   return _rec_dropped;
+}
+#endif
+
 /* THE MITOCHONDRIA */
 
 void CommManager::step() {
 
    if( _total_reporters ) {
 
-      if( _time_to_talk(_report_period) )
-         _report();
+      if( _grouped )
+         _snapshot();
+
+      for( uint8_t link = 0; link < _total_links; link++ )
+         if( _time_to_talk(link) )
+            _report(link);
 
+      // (one time for all, so a snapshot lands in the same slots)
+      uint32_t now = micros();
       for( uint8_t reporter = 0; reporter < _total_reporters; reporter++ )
-         _record(reporter);
+         _record(reporter, now);
+#if !defined S302_UNO
+      if( _store )
+         _rec_step(now);
+#endif
 
    }
 
@@ -320,9 +485,11 @@ void CommManager::step() {
 
 #ifdef ESP32
 
-   int32_t leftover = _step_period - (micros() - _secondary_timer);
+   int32_t leftover = _time_left();
    _headroom = leftover > 0? leftover : 0;
    _headroom_rp = (float)(min((int32_t)_headroom_rp, _headroom));
+   _idle();
+   leftover = _time_left();
    if( leftover > 1000 ) {
       vTaskDelay(leftover / 1000);
       leftover = leftover % 1000;
@@ -340,6 +507,14 @@ void CommManager::step() {
 }
 
 #ifdef ESP32
+void CommManager::_rec_walk(void* param) {
+   CommManager* ptr = (CommManager*)param;
+   for(;;) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      ptr->_rec_flush();
+   }
+}
+
 void CommManager::_walk(void* param) {
    CommManager* ptr = (CommManager*)param;
    uint32_t watchdogTimer = millis();
@@ -359,32 +534,109 @@ uint32_t CommManager::headroom() {
    return _headroom;
 }
 
+/* :: throughput( transport ) */
+
+uint32_t CommManager::throughput(uint8_t transport) {
+   if( transport >= _total_links )
+      return 0;
+   return _links[transport].bps;
+}
+
+/* :: addIdleJob( job, context, budget, patience ) */
+
+bool CommManager::addIdleJob(S302IdleJob job, void* ctx, uint32_t budget,
+                             uint8_t patience) {
+   if( _total_jobs >= MAX_IDLE_JOBS || !job )
+      return false;
+   S302Job& j = _jobs[_total_jobs++];
+   j.fn = job;
+   j.ctx = ctx;
+   j.budget = budget;
+   j.patience = patience;
+   j.skipped = 0;
+   return true;
+}
+
 /* PRIVATE ROUTINES */
 
+/* :: _can_report( burst, type ) */
+
+bool CommManager::_can_report(uint8_t burst, uint8_t type) {
+   // Whether one more reporter with this burst fits, both in memory and
+   // in the report period of every link that would carry it
+   if( _total_reporters >= MAX_REPORTERS
+   ||  burst == 0
+   ||  burst > MAX_BURST
+   ||  _slots_used + burst * (type & 0x0F) > S302_RECORD_LEN
+   ||  burst > (float)_report_period / (float)_step_period )
+      return false;
+   for( uint8_t link = 0; link < _total_links; link++ )
+      if( (_links[link].reporters & (1UL << _total_reporters))
+      &&  burst > (float)_links[link].report_period / (float)_step_period )
+         return false;
+   return true;
+}
+
+/* :: _add_reporter( link, type, burst ) */
+
+void CommManager::_add_reporter(void* linker, uint8_t type, uint8_t burst) {
+   // Each reporter gets burst * width bytes of every link's recordings
+   _reporters[_total_reporters] = linker;
+   _types[_total_reporters] = type;
+   _bursts[_total_reporters] = burst;
+   _slots[_total_reporters] = _slots_used;
+   _slots_used += burst * (type & 0x0F);
+}
+
+/* :: _type_name( type, name ) */
+
+void CommManager::_type_name(uint8_t type, char* name) {
+   // As the GUI knows them: bool, float, double, int8 ... uint64
+   uint8_t width = type & 0x0F;
+   switch( type & 0xF0 ) {
+      case S302_BOOL:  strcpy(name, "bool"); return;
+      case S302_FLOAT: strcpy(name, width == 8? "double":"float"); return;
+      case S302_UINT:  strcpy(name, "uint"); break;
+      default:         strcpy(name, "int");  break;
+   }
+   itoa(8 * width, name + strlen(name), 10);
+}
+
 /* :: _control() */
 
 void CommManager::_control() {
 
-   // READ incoming message, if any
-   _buf[0] = '\0';
-#ifdef S302_SERIAL
-   if( !_serial->available() )
-      return;
-   uint8_t i = 0;
-   for(;;) {
-      if( _serial->available() ) {
-         _buf[i] = (char)(_serial->read());
-         if( _buf[i++] == '\n' )
-            break; // we need a newline
+   // READ incoming bytes, if any, a line at a time per link
+   for( uint8_t link = 0; link < _total_links; link++ ) {
+      S302Link& l = _links[link];
+      l.ops->loop(l.self);
+      while( l.ops->available(l.self) > 0 ) {
+         char c = (char)l.ops->read(l.self);
+         if( c == '\n' ) {
+            if( l.rx_len < MAX_RX_LEN ) {
+               l.rx[l.rx_len++] = '\n'; // we need a newline
+               l.rx[l.rx_len] = '\0';
+               _parse(link);
+            }
+            l.rx_len = 0;
+         } else if( l.rx_len < MAX_RX_LEN - 2 ) {
+            l.rx[l.rx_len++] = c;
+         } else {
+            l.rx_len = MAX_RX_LEN; // too long, skip to the next newline
+         }
       }
    }
-   _buf[i] = '\0';
-#elif defined S302_WEBSOCKETS
-   _wss.loop();
-#endif
+
+}
+
+/* :: _parse( link ) */
+
+void CommManager::_parse(uint8_t link) {
+
+   char* msg = _links[link].rx;
 
    // PARSE the message
-   switch(_buf[0]) {
+   switch(msg[0]) {
       
       case '\0': {
          // (No message)
@@ -392,41 +644,48 @@ void CommManager::_control() {
       } break;
       
       case '\n': {
-         // (GUI is asking for the build string!)
+         // (GUI is asking for the build string! It goes in the idle time)
+         _links[link].build_due = true;
+         return;
+      } break;
 
-         // prepare current values!
-         strcpy(_buf, "#\r");
-         for( uint8_t i = 0; i < _total_controls; i++ ) {
-            if( _ctrl_types[i] ) {
-               // if float
-#ifdef S302_UNO
-               dtostrf(*_controls[i], 0, MAX_PREC, _tmp);
-#else
-               sprintf(_tmp, "%f", *_controls[i]);
-#endif
-               strcat(_buf, _tmp);
-            } else {
-               // if bool
-               strcat(_buf, *((bool*)_controls[i])? "true":"false");
-            }
-            strcat(_buf, "\r");
+#if !defined S302_UNO
+      case 'F': {
+         // (send the flight recorder's capture, a page at a time, from
+         // the start or from where the GUI lost it: "F<position>\n")
+         if( _store ) {
+            _download_to = link + 1;
+            _download_pos = atol(msg + 1);
          }
+         return;
+      } break;
+#endif
 
-         // send buildstring!
-         BROADCAST(_build_string, strlen(_build_string));
-         BROADCAST(_buf, strlen(_buf));
-         BROADCAST("\n", 2);
+      case 'P': {
+         // (ping: answer with when it arrived and when the answer left,
+         // then the host's token back)
+         uint32_t rx = micros();
+         SEND(link, "\fP", 2);
+         SEND(link, &rx, 4);
+         uint32_t tx = micros();
+         SEND(link, &tx, 4);
+         SEND(link, msg + 1, strlen(msg) - 2);
+         SEND(link, "\n", 2);
          return;
       } break;
 
       default: {
          // (update the value)
-         if( _buf[strlen(_buf)-1] != '\n' )
+         if( msg[strlen(msg)-1] != '\n' )
             break; // only structured code allowed beyond this point
       
-         int id = atoi(strtok(_buf, ":"));
-         char val[24];
-         strcpy(val, strtok(NULL, "\n"));
+         char* id_str = strtok(msg, ":");
+         char* val = strtok(NULL, "\n");
+         if( !id_str || !val )
+            break;
+         int id = atoi(id_str);
+         if( id < 0 || id >= _total_controls )
+            break;
          if( !strcmp(val, "true") ) {
             *(bool*)_controls[id] = true;
          } else if ( !strcmp(val, "false") ) {
@@ -440,121 +699,695 @@ void CommManager::_control() {
    
 }
 
-/* :: _record( reporter ) */
+/* :: _send_build_string( link ) */
 
-void CommManager::_record(uint8_t reporter) {
-   float burst;
-#ifdef TEENSYDUINO
-   burst = (float)_report_timer
+void CommManager::_send_build_string(uint8_t link) {
+
+   // prepare current values!
+   strcpy(_buf, "#\r");
+   for( uint8_t i = 0; i < _total_controls; i++ ) {
+      if( _ctrl_types[i] ) {
+         // if float
+#ifdef S302_UNO
+         dtostrf(*_controls[i], 0, MAX_PREC, _tmp);
 #else
-   burst = (float)(micros() - _report_timer)
+         sprintf(_tmp, "%f", *_controls[i]);
 #endif
-       * (float)_bursts[reporter] / (float)_report_period;
-   uint8_t index = (int)burst; // round down to nearest index
-   memcpy(&_recordings[reporter][index], (char*)_reporters[reporter], 4);
+         strcat(_buf, _tmp);
+      } else {
+         // if bool
+         strcat(_buf, *((bool*)_controls[i])? "true":"false");
+      }
+      strcat(_buf, "\r");
+   }
+
+   // (a new GUI needs the current value of change-only reporters)
+   _links[link].unsent = S302_ALL_REPORTERS;
+
+   // send buildstring, minus the reporters this link doesn't carry!
+   uint16_t from = 0;
+   for( uint8_t reporter = 0; reporter < _total_reporters; reporter++ ) {
+      if( _links[link].reporters & (1UL << reporter) )
+         continue;
+      SEND(link, _build_string + from, _spans[reporter][0] - from);
+      from = _spans[reporter][1];
+   }
+   SEND(link, _build_string + from, strlen(_build_string) - from);
+   SEND(link, _buf, strlen(_buf));
+   SEND(link, "\n", 2);
+
 }
 
-/* :: _report() */
+/* :: _burst( link, reporter ) */
+
+uint8_t CommManager::_burst(uint8_t link, uint8_t reporter) {
+   // How many recordings the reporter makes per report on this link,
+   // after adaptive thinning, and never more than there are steps
+   S302Link& l = _links[link];
+   uint8_t  burst = ((uint16_t)_bursts[reporter] * l.keep + 254) / 255;
+   uint32_t steps = l.report_period / _step_period;
+   if( burst > steps )
+      burst = steps;
+   return burst? burst : 1;
+}
 
-void CommManager::_report() {
-   // Send debug messages if any
-   // Then send data report
+/* :: _ts_shift( link ) */
 
-   TAKE
-   
-   // Debug messages
-   uint16_t n = strlen(_debug_string);
-   if( n > 2 ) {
-      BROADCAST("\fD", 2);
-      BROADCAST(&_headroom_rp, 4);
-      BROADCAST(_debug_string, n);
-      BROADCAST("\n", 2);
-      _debug_string[0] = '\0';
+uint8_t CommManager::_ts_shift(uint8_t link) {
+   // Sample times are 16-bit offsets into the report period, in units of
+   // 2^shift microseconds, so they always span it
+   uint8_t shift = 0;
+   while( (_links[link].report_period >> shift) > 0xFFFF )
+      shift++;
+   return shift;
+}
+
+/* :: _snapshot() */
+
+void CommManager::_snapshot() {
+   // Copy the group while no update is under way, and check none began
+   // during the copy. Give up after a few tries rather than wait; the
+   // group then records its last whole copy again.
+   uint64_t copy[MAX_REPORTERS];
+   for( uint8_t tries = 0; tries < S302_SNAPSHOT_TRIES; tries++ ) {
+      S302_SEQ seq = _seq;
+      if( seq & 1 )
+         continue;
+      FENCE
+      for( uint8_t reporter = 0; reporter < _total_reporters; reporter++ )
+         if( _grouped & (1UL << reporter) )
+            memcpy(&copy[reporter], _reporters[reporter],
+                   _types[reporter] & 0x0F);
+      FENCE
+      if( _seq != seq )
+         continue;
+      for( uint8_t reporter = 0; reporter < _total_reporters; reporter++ )
+         if( _grouped & (1UL << reporter) )
+            _snapshots[reporter] = copy[reporter];
+      return;
    }
-   _headroom_rp = (float)INT32_MAX;
+}
 
-   GIVE
+/* :: _source( reporter ) */
+
+const void* CommManager::_source(uint8_t reporter) {
+   // Where to record the reporter from
+   if( _grouped & (1UL << reporter) )
+      return &_snapshots[reporter];
+   return _reporters[reporter];
+}
+
+/* :: _value( reporter ) */
+
+double CommManager::_value(uint8_t reporter) {
+   // (only to compare against the deadband)
+   const void* p = _source(reporter);
+   switch( _types[reporter] ) {
+      case S302_INT   | 1: return *(const int8_t*)p;
+      case S302_INT   | 2: return *(const int16_t*)p;
+      case S302_INT   | 4: return *(const int32_t*)p;
+      case S302_INT   | 8: return *(const int64_t*)p;
+      case S302_UINT  | 1: return *(const uint8_t*)p;
+      case S302_UINT  | 2: return *(const uint16_t*)p;
+      case S302_UINT  | 4: return *(const uint32_t*)p;
+      case S302_UINT  | 8: return *(const uint64_t*)p;
+      case S302_FLOAT | 4: return *(const float*)p;
+      case S302_FLOAT | 8: return *(const double*)p;
+      case S302_BOOL  | 1: return *(const bool*)p;
+   }
+   return 0;
+}
+
+/* :: _block_size( type, count ) */
+
+uint16_t CommManager::_block_size(uint8_t type, uint8_t count) {
+   // Bytes taken by this many samples in a report (bools are bits)
+   if( (type & 0xF0) == S302_BOOL )
+      return (count + 7) / 8;
+   return count * (type & 0x0F);
+}
+
+/* :: _send_samples( link, reporter, count ) */
+
+size_t CommManager::_send_samples(uint8_t link, uint8_t reporter,
+                                  uint8_t count) {
+   uint8_t* samples = &_recordings[link][_slots[reporter]];
+   if( (_types[reporter] & 0xF0) != S302_BOOL )
+      return SEND(link, samples, _block_size(_types[reporter], count));
+   // pack bools, first sample in the lowest bit
+   uint8_t bits[(MAX_BURST + 7) / 8] = {0};
+   for( uint8_t i = 0; i < count; i++ )
+      if( samples[i] )
+         bits[i / 8] |= 1 << (i % 8);
+   return SEND(link, bits, (count + 7) / 8);
+}
+
+/* :: _record( reporter, time ) */
+
+void CommManager::_record(uint8_t reporter, uint32_t now) {
+   for( uint8_t link = 0; link < _total_links; link++ ) {
+      S302Link& l = _links[link];
+      if( !(l.reporters & (1UL << reporter))
+      ||  l.report_period == S302_NO_REPORTS )
+         continue;
+      uint8_t n = _burst(link, reporter);
+      uint8_t width = _types[reporter] & 0x0F;
+      uint8_t* slot = &_recordings[link][_slots[reporter]];
+
+      if( _change_only[reporter] ) {
+         // Only when it moved enough, or hasn't been sent in a while
+         uint8_t c = _change_only[reporter] - 1;
+         double value = _value(reporter);
+         if( !(l.unsent & (1UL << reporter))
+         &&  fabs(value - _last_values[link][c]) <= _deadbands[c]
+         &&  ( !_max_intervals[c]
+            || now - _last_times[link][c] < _max_intervals[c] ) )
+            continue;
+         uint8_t& count = _counts[link][c];
+         uint8_t index = count < n? count++ : n - 1; // (full: keep the newest)
+         uint32_t offset = (now - l.report_timer) >> _ts_shift(link);
+         _offsets[link][c][index] = offset > 0xFFFF? 0xFFFF : offset;
+         memcpy(slot + index * width, _source(reporter), width);
+         _last_values[link][c] = value;
+         _last_times[link][c] = now;
+         l.unsent &= ~(1UL << reporter);
+         continue;
+      }
+
+      float burst = (float)(now - l.report_timer)
+                  * (float)n / (float)l.report_period;
+      uint8_t index = (int)burst; // round down to nearest index
+      if( index >= n )
+         index = n - 1; // (running late)
+      memcpy(slot + index * width, _source(reporter), width);
+   }
+}
+
+/* :: _report( link ) */
+
+void CommManager::_report(uint8_t link) {
+   // Send the data report (debug messages follow in the idle time)
+   _debug_due = true;
+
+   S302Link& l = _links[link];
+   uint16_t size = _report_size(link);
+
+   // How much of the transmit queue is still waiting to go out?
+   int32_t room = _room(link);
+   if( room > l.room_max )
+      l.room_max = room;
+   int32_t waiting = room >= 0? l.room_max - room : 0;
+   bool growing = waiting > 0 && waiting >= l.waiting;
+   if( l.rp_max ) {
+      // (if it never emptied, what left it since is what the link carries)
+      if( waiting > 0 && l.queued > waiting )
+         l.capacity = (uint64_t)(l.queued - waiting) * 1000000 / l.report_period;
+      l.waiting = l.queued = waiting;
+      if( room >= 0 && room < size ) {
+         _adapt(link, true, false); // sending now would block, skip this one
+         for( uint8_t reporter = 0; reporter < _total_reporters; reporter++ )
+            if( _change_only[reporter]
+            &&  _counts[link][_change_only[reporter] - 1] ) {
+               _counts[link][_change_only[reporter] - 1] = 0;
+               l.unsent |= 1UL << reporter; // (send the latest next time)
+            }
+         return;
+      }
+   }
 
    // Data report
-   strcpy(_buf, "\fR");
-   BROADCAST(_buf, 2);
+   uint32_t start = micros();
+   size_t sent = 0;
+   uint32_t base = l.report_timer - l.report_period; // when they began
+   uint8_t  shift = _ts_shift(link);
+   sent += SEND(link, "\fR", 2);
+   sent += SEND(link, &l.report_period, 4); // the time these recordings span
+   sent += SEND(link, &base, 4);
+   sent += SEND(link, &shift, 1);
    
-   for( uint8_t reporter = 0; reporter < _total_reporters; reporter++ )
-      for( uint8_t burst = 0; burst < _bursts[reporter]; burst++ ) 
-         BROADCAST(_recordings[reporter][burst], 4);
+   for( uint8_t reporter = 0; reporter < _total_reporters; reporter++ ) {
+      if( !(l.reporters & (1UL << reporter)) )
+         continue;
+      if( _change_only[reporter] ) {
+         // count (top bit set: timestamped), offsets, then the samples
+         uint8_t c = _change_only[reporter] - 1;
+         uint8_t count = _counts[link][c];
+         uint8_t head = 0x80 | count;
+         sent += SEND(link, &head, 1);
+         sent += SEND(link, _offsets[link][c], 2 * count);
+         sent += _send_samples(link, reporter, count);
+         _counts[link][c] = 0;
+         continue;
+      }
+      uint8_t burst = _burst(link, reporter);
+      sent += SEND(link, &burst, 1);
+      sent += _send_samples(link, reporter, burst);
+   }
          
-   BROADCAST("\n", 2);
+   sent += SEND(link, "\n", 2);
+
+   // Measure throughput about once a second (counting what the transport
+   // took: here on the Uno, as the queue drains elsewhere, less what's
+   // still in the transport's own queue)
+   uint32_t now = micros();
+#if defined S302_UNO
+   l.tx_bytes += sent;
+#endif
+   if( now - l.tx_timer >= 1000000 ) {
+#if !defined S302_UNO
+      int32_t tx_room = l.ops->availableForWrite(l.self);
+      int32_t pending = tx_room >= 0? l.tx_room_max - tx_room : 0;
+      l.tx_bytes = max((int32_t)0, (int32_t)l.tx_bytes - pending + l.tx_pending);
+      l.tx_pending = pending;
+#endif
+      l.bps = (uint64_t)l.tx_bytes * 1000000 / (now - l.tx_timer);
+      l.tx_bytes = 0;
+      l.tx_timer = now;
+   }
+
+   if( l.rp_max ) {
+      l.queued = waiting + sent;
+      // backing up, cut short, or blocked for longer than a step
+      bool congested = growing || sent < size || now - start > _step_period;
+#if !defined S302_UNO
+      congested = congested || l.stalled;
+      l.stalled = false;
+#endif
+      _adapt(link, congested, !congested && waiting == 0);
+   }
 
 }
 
-/* :: _time_to_talk( time_to_wait ) */
+/* :: _report_size( link ) */
+
+uint16_t CommManager::_report_size(uint8_t link) {
+   uint16_t size = 2 + 4 + 4 + 1 + 2;
+   for( uint8_t reporter = 0; reporter < _total_reporters; reporter++ ) {
+      if( !(_links[link].reporters & (1UL << reporter)) )
+         continue;
+      uint8_t count = _change_only[reporter]
+                    ? _counts[link][_change_only[reporter] - 1]
+                    : _burst(link, reporter);
+      size += 1 + _block_size(_types[reporter], count);
+      if( _change_only[reporter] )
+         size += 2 * count; // (time offsets)
+   }
+   return size;
+}
 
-bool CommManager::_time_to_talk(uint32_t time_to_wait) {
-   // Whether or not enough time has passed according to the given
-   // time period. Determines when to report data.
-   // depends on the microcontroller
-#ifdef TEENSYDUINO
-   if( time_to_wait <= _report_timer ) {
-      _report_timer = _report_timer - time_to_wait;
-#else
-   if( time_to_wait <= (micros() - _report_timer) ) {
-      _report_timer = _report_timer + time_to_wait;
-#endif
+/* :: _adapt( link, congested, calm ) */
+
+void CommManager::_adapt(uint8_t link, bool congested, bool calm) {
+   // Back off straight to below the capacity measured while congested, or
+   // one notch if it isn't known yet. Creep back up one notch at a time
+   // once the link has stayed calm for a while, waiting longer after each
+   // back-off. Changes take effect from the report period just begun.
+   S302Link& l = _links[link];
+
+   if( congested ) {
+      l.calm = 0;
+      l.calm_needed = min(S302_CALM_MAX, 2 * l.calm_needed);
+      while( _slower(link)
+         &&  l.capacity
+         &&  (uint64_t)_report_size(link) * 1000000 / l.report_period
+               > l.capacity / 8 * 7 );
+      return;
+   }
+
+   if( !calm || ++l.calm < l.calm_needed )
+      return;
+   l.calm = 0;
+   l.calm_needed = max(S302_CALM_REPORTS, l.calm_needed / 2);
+   _faster(link);
+}
+
+/* :: _slower( link ) */
+
+bool CommManager::_slower(uint8_t link) {
+   // Stretch the report period first (fewer, fuller reports), then thin
+   // the bursts once it can't stretch any further
+   S302Link& l = _links[link];
+   if( l.report_period < l.rp_max ) {
+      l.report_period = min(l.rp_max, l.report_period + l.report_period / 4);
+      return true;
+   }
+   for( uint8_t reporter = 0; reporter < _total_reporters; reporter++ )
+      if( (l.reporters & (1UL << reporter)) && _burst(link, reporter) > 1 ) {
+         l.keep = l.keep * 4 / 5;
+         return true;
+      }
+   return false; // (nothing left to give)
+}
+
+/* :: _faster( link ) */
+
+bool CommManager::_faster(uint8_t link) {
+   // The other way around
+   S302Link& l = _links[link];
+   if( l.keep < 255 ) {
+      l.keep = min(255, l.keep + l.keep / 4 + 1);
+      return true;
+   }
+   if( l.report_period <= l.rp_min )
+      return false;
+   l.report_period = max(l.rp_min, l.report_period - l.report_period / 5);
+   return true;
+}
+
+/* :: _time_to_talk( link ) */
+
+bool CommManager::_time_to_talk(uint8_t link) {
+   // Whether or not enough time has passed according to the link's
+   // report period. Determines when to report data.
+   S302Link& l = _links[link];
+   if( l.report_period == S302_NO_REPORTS )
+      return false;
+   if( l.report_period <= (micros() - l.report_timer) ) {
+      l.report_timer = l.report_timer + l.report_period;
       return true;
    }
    return false;
 }
 
+/* :: _rec_step( time ) */
+
+#if !defined S302_UNO
+void CommManager::_rec_step(uint32_t now) {
+   // Append a record to the page being filled. Full pages are written
+   // out elsewhere (the recorder's task on the ESP32, an idle job otherwise)
+   if( !_rec_active ) {
+      if( !_rec_on )
+         return;
+      _rec_active = true;
+   }
+   if( !_rec_on ) {
+      // finished: hand over what there is, storage closes up after it
+      _rec_active = false;
+      if( _page_len[_page] )
+         _page_full[_page] = true;
+      FENCE
+      _rec_ending = true;
+#if defined ESP32
+      xTaskNotifyGive(_rec_task);
+#endif
+      return;
+   }
+
+   // (never split a record between a page and a dropped one)
+   uint16_t room = S302_PAGE_LEN - _page_len[_page]
+                 + (_page_full[!_page]? 0 : S302_PAGE_LEN);
+   if( _page_full[_page] || room < _rec_len ) {
+      _rec_dropped++;
+      return;
+   }
+   _rec_put(&now, 4);
+   for( uint8_t reporter = 0; reporter < _total_reporters; reporter++ )
+      if( _rec_reporters & (1UL << reporter) )
+         _rec_put(_source(reporter), _types[reporter] & 0x0F);
+}
+
+/* :: _rec_put( data, length ) */
+
+void CommManager::_rec_put(const void* data, uint8_t len) {
+   const uint8_t* bytes = (const uint8_t*)data;
+   while( len ) {
+      uint16_t at = _page_len[_page];
+      uint16_t n = min((uint16_t)len, (uint16_t)(S302_PAGE_LEN - at));
+      memcpy(&_pages[_page][at], bytes, n);
+      _page_len[_page] = at + n;
+      bytes += n;
+      len -= n;
+      if( _page_len[_page] == S302_PAGE_LEN ) {
+         FENCE
+         _page_full[_page] = true;
+#if defined ESP32
+         xTaskNotifyGive(_rec_task);
+#endif
+         _page = !_page;
+      }
+   }
+}
+
+/* :: _rec_flush() */
+
+void CommManager::_rec_flush() {
+   // Write out full pages, oldest first
+   while( _page_full[_page_next] ) {
+      uint8_t page = _page_next;
+      FENCE
+      _store_ops->write(_store, _pages[page], _page_len[page]);
+      _page_len[page] = 0;
+      _page_next = !page;
+      FENCE
+      _page_full[page] = false; // (step may fill it again from here)
+   }
+   if( _rec_ending ) {
+      _store_ops->end(_store);
+      _rec_ending = false;
+   }
+}
+
+/* :: _flush_job( this ) */
+
+void CommManager::_flush_job(void* self) {
+   ((CommManager*)self)->_rec_flush();
+}
+
+/* :: _download_job( this ) */
+
+void CommManager::_download_job(void* self) {
+   ((CommManager*)self)->_download();
+}
+
+/* :: _download() */
+
+void CommManager::_download() {
+   // One page of the capture per step: "\fF", where it starts (4 bytes),
+   // how long it is (2 bytes), the bytes. An empty page ends it.
+   if( !_download_to || _rec_ending )
+      return; // (none, or not until the capture is complete)
+   uint8_t link = _download_to - 1;
+   int32_t room = _room(link);
+   if( room >= 0 && room < 2 + 4 + 2 + S302_PAGE_LEN + 2 )
+      return; // (next time)
+
+   // (nothing to send while still recording)
+   uint16_t len = 0;
+   if( !_rec_on && !_rec_active )
+      len = _store_ops->read(_store, _download_pos,
+                             _pages[0], S302_PAGE_LEN);
+   SEND(link, "\fF", 2);
+   SEND(link, &_download_pos, 4);
+   SEND(link, &len, 2);
+   SEND(link, _pages[0], len);
+   SEND(link, "\n", 2);
+   _download_pos += len;
+   if( !len )
+      _download_to = 0;
+}
+#endif
+
 /* :: _wait() */
 
 void CommManager::_wait() {
+   // The headroom is what the step left of its period. The idle jobs
+   // (storage and downloads among them) take from it, then the rest is
+   // slept.
+#ifdef TEENSYDUINO
+   _headroom = (int32_t)_step_period - (int32_t)(uint32_t)_main_timer;
+#else
+   _headroom = _step_period - (micros() - _main_timer);
+#endif
+   _headroom_rp = (float)(min((int32_t)_headroom_rp, _headroom));
+   _idle();
    // How we wait depends on the microcontroller
 #ifdef TEENSYDUINO
-   uint32_t before = _main_timer;
    while(_step_period > _main_timer);
-   _headroom = _main_timer - before;
    _main_timer = 0;
 #else
-   _headroom = _step_period - (micros() - _main_timer);
-   if( _headroom > 0 )
-      delayMicroseconds(_headroom);
+   int32_t left = _time_left();
+   if( left > 0 )
+      delayMicroseconds(left);
    _main_timer = micros();
 #endif
-   _headroom_rp = (float)(min((int32_t)_headroom_rp, _headroom));
 }
 
-/* WebSocket event */
+/* :: _time_left() */
 
-#ifdef S302_WEBSOCKETS
-void CommManager::_on_websocket_event(
-   uint8_t num, WStype_t type, uint8_t* payload, size_t length) {
-   
-   switch(type) {
-#ifdef S302_VERBOSE
-      case WStype_DISCONNECTED: {
-         Serial.printf("[%u] Disconnected\n", num);
-      } break;
-      case WStype_CONNECTED: {
-         Serial.printf("[%u] Connected from %s\n",
-            num, _wss.remoteIP(num).toString().c_str());
-      } break;
+int32_t CommManager::_time_left() {
+   // Until the next step is due (negative when running late)
+#if defined TEENSYDUINO
+   return (int32_t)_step_period - (int32_t)(uint32_t)_main_timer;
+#elif defined ESP32
+   return _step_period - (micros() - _secondary_timer);
+#else
+   return _step_period - (micros() - _main_timer);
 #endif
-      case WStype_TEXT: {
-         if( payload[0] != '\0' ) {
-            memcpy(_buf, payload, length);
-            _buf[length] = '\0';
-#ifdef S302_VERBOSE
-            Serial.printf("[%u] Received: ", num);
-            Serial.println((char*)payload);
-         } else {
-            Serial.printf("[%u] Received empty message!\n", num);
+}
+
+/* :: _idle() */
+
+void CommManager::_idle() {
+   // The step's own work is done. Hand the transports what it queued, then
+   // run each job whose budget fits in what's left (always, for a budget
+   // of 0), or that has run out of patience, and hand over what they
+   // queued too. Only the latter may run past the deadline.
+#if !defined S302_UNO
+   for( uint8_t link = 0; link < _total_links; link++ )
+      _drain(link, false);
 #endif
+   for( uint8_t i = 0; i < _total_jobs; i++ ) {
+      S302Job& j = _jobs[i];
+      if( j.budget && (int32_t)j.budget > _time_left() ) {
+         if( j.skipped < j.patience ) {
+            j.skipped++;
+            continue;
          }
-      } break;
+         if( !j.patience )
+            continue; // (never late)
+      }
+      j.skipped = 0;
+      j.fn(j.ctx);
+   }
+#if !defined S302_UNO
+   for( uint8_t link = 0; link < _total_links; link++ )
+      _drain(link, false);
+#endif
+}
+
+/* :: _build_job( this ) */
 
-      default: break;
+void CommManager::_build_job(void* self) {
+   ((CommManager*)self)->_send_builds();
+}
+
+/* :: _debug_job( this ) */
+
+void CommManager::_debug_job(void* self) {
+   ((CommManager*)self)->_send_debug();
+}
+
+/* :: _send_builds() */
+
+void CommManager::_send_builds() {
+   // To the links that asked for it since
+   for( uint8_t link = 0; link < _total_links; link++ )
+      if( _links[link].build_due ) {
+         _links[link].build_due = false;
+         _send_build_string(link);
+      }
+}
+
+/* :: _send_debug() */
+
+void CommManager::_send_debug() {
+   // Debug messages if any, after a report, to every link, with the lowest
+   // headroom over the report period
+   if( !_debug_due )
+      return;
+   _debug_due = false;
+
+   TAKE
+   uint16_t n = strlen(_debug_string);
+   if( n > 2 ) {
+      for( uint8_t l = 0; l < _total_links; l++ ) {
+         SEND(l, "\fD", 2);
+         SEND(l, &_headroom_rp, 4);
+         SEND(l, _debug_string, n);
+         SEND(l, "\n", 2);
+      }
+      _debug_string[0] = '\0';
+   }
+   _headroom_rp = (float)INT32_MAX;
+   GIVE
+}
+
+/* :: _room( link ) */
+
+int32_t CommManager::_room(uint8_t link) {
+   // Free space in the transmit queue: the transport's own on the Uno, the
+   // library's in front of it elsewhere. -1 if the transport can't tell
+   // and nothing is queued, as it's then written to directly.
+   S302Link& l = _links[link];
+   int32_t room = l.ops->availableForWrite(l.self);
+#if defined S302_UNO
+   return room;
+#else
+   uint16_t used = _tx_used(link);
+   return room < 0 && !used? -1 : S302_TX_LEN - 1 - used;
+#endif
+}
+
+#if !defined S302_UNO
+
+/* :: _tx_used( link ) */
+
+uint16_t CommManager::_tx_used(uint8_t link) {
+   S302Link& l = _links[link];
+   return (l.tx_head - l.tx_tail + S302_TX_LEN) % S302_TX_LEN;
+}
+
+/* :: _queue( link, bytes, length ) */
+
+size_t CommManager::_queue(uint8_t link, const uint8_t* msg, size_t len) {
+   // Into the link's transmit queue, for the idle time to send. When it's
+   // full, wait on the transport to make room, as a direct write would.
+   // A transport that can't tell its room (e.g. UDP, which takes a whole
+   // message or drops it) is written to directly, so a message is never
+   // split between two of its writes.
+   S302Link& l = _links[link];
+   if( l.tx_head == l.tx_tail && l.ops->availableForWrite(l.self) < 0 ) {
+      size_t took = l.ops->write(l.self, msg, len);
+      l.tx_bytes += took;
+      return took;
    }
+   size_t done = 0;
+   while( done < len ) {
+      uint16_t room = S302_TX_LEN - 1 - _tx_used(link);
+      if( !room ) {
+         if( !_drain(link, true) )
+            break; // (the transport takes nothing, drop the rest)
+         continue;
+      }
+      uint16_t n = min((size_t)room, len - done);
+      n = min(n, (uint16_t)(S302_TX_LEN - l.tx_head)); // (up to the wrap)
+      memcpy(l.tx + l.tx_head, msg + done, n);
+      l.tx_head = (l.tx_head + n) % S302_TX_LEN;
+      done += n;
+   }
+   return done;
 }
+
+/* :: _drain( link, block ) */
+
+bool CommManager::_drain(uint8_t link, bool block) {
+   // Hand the transport what it takes without waiting, or, to make room,
+   // all of it. False if it took none.
+   S302Link& l = _links[link];
+   int32_t room = l.ops->availableForWrite(l.self);
+   if( room > l.tx_room_max )
+      l.tx_room_max = room;
+   uint16_t used = _tx_used(link);
+   if( !used )
+      return true;
+   uint16_t n = (block || room < 0 || room > used)? used : room;
+   uint32_t start = micros();
+   size_t sent = 0;
+   while( sent < n ) {
+      uint16_t chunk = min((uint16_t)(n - sent),
+                           (uint16_t)(S302_TX_LEN - l.tx_tail)); // (up to the wrap)
+      size_t took = l.ops->write(l.self, l.tx + l.tx_tail, chunk);
+      l.tx_tail = (l.tx_tail + took) % S302_TX_LEN;
+      l.tx_bytes += took;
+      sent += took;
+      if( took < chunk )
+         break;
+   }
+   if( micros() - start > _step_period )
+      l.stalled = true;
+   return sent > 0;
+}
+
 #endif
 
 /* Else */
@@ -4,45 +4,36 @@
 #ifndef _Six302_H_
 #define _Six302_H_
 
-/* CHOOSE ONE: */
+/* OPTIONAL: */
 
-//#define S302_SERIAL
-//#define S302_WEBSOCKETS
+//#define S302_WEBSOCKETS // lets `connect("ssid", "p/w")` serve the GUI over WiFi
+
+/* Serial is always available through `connect(&Serial, baud)`. Any other
+   transport, or several at once, can be attached with `addTransport`
+   (see S302Transport.h) without touching this file. */
 
 /* WebSockets options */
 
 #define S302_PORT 80
-#define S302_VERBOSE // enable this to print debug information to Serial (WebSockets)
+//#define S302_VERBOSE // enable this to print debug information to Serial (WebSockets),
+                      // but not while Serial also carries the GUI (it'd corrupt the stream)
 
 // Add ESP32-C3 specific detection
 #if defined(ARDUINO_USB_MODE)
 #include <HWCDC.h>
 #endif
 
-#if ( defined S302_SERIAL &&  defined S302_WEBSOCKETS) || \
-    (!defined S302_SERIAL && !defined S302_WEBSOCKETS)
-#error "Choose a communication setup"
-#endif
-
-#if defined (S302_WEBSOCKETS) && !defined (ESP32) && !defined (ESP8266) && \
-      !defined (PICO_W) && !defined (PICO_2_W) 
-#error "WebSockets is only available for the ESP32 or ESP8266 or Pico W"
-#endif
-
 /* #includes */
 
 #include <Arduino.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "S302Transport.h"
+#include "S302Storage.h"
+
 #if defined S302_WEBSOCKETS
-#ifdef ESP8266
-#include <ESP8266WiFi.h>
-#else
-#include <WiFi.h>
-#endif
-#include <WebSocketsServer.h>
-using namespace std::placeholders;
+#include "S302WebSockets.h"
 #endif
 
 /* Sugar */
@@ -55,26 +46,35 @@ using namespace std::placeholders;
 #define GIVE
 #endif
 
-#if defined S302_SERIAL
-#define BROADCAST(msg, len) _serial->write((uint8_t*)msg, len)
-#elif defined S302_WEBSOCKETS
-#define BROADCAST(msg, len) _wss.broadcastBIN((uint8_t*)msg, len)
-#endif
+// (orders the seqlock's counter against the data it guards, across cores)
+#define FENCE __atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-#if defined (ESP32) || (ESP8266) || (TEENSYDUINO)
+// (a host build, without ARDUINO, gets the limits of the bigger boards)
+#if defined (ESP32) || (ESP8266) || (TEENSYDUINO) || !defined (ARDUINO)
 #else
 #define S302_UNO
 #endif
 
+// (into the transport's transmit queue, straight to it on the Uno)
+#if defined S302_UNO
+#define SEND(link, msg, len) \
+   _links[link].ops->write(_links[link].self, (const uint8_t*)(msg), len)
+#else
+#define SEND(link, msg, len) \
+   _queue(link, (const uint8_t*)(msg), len)
+#endif
+
 /* Memory constraints */
 
 #if defined S302_UNO
 
 // ARDUINO UNO:
 
-         #define MAX_CONTROLS  5 // Joystick counts as two controls btw
-         #define MAX_REPORTERS 5
-         #define MAX_BURST     5
+         #define MAX_CONTROLS   5 // Joystick counts as two controls btw
+         #define MAX_REPORTERS  5
+         #define MAX_BURST      5
+         #define MAX_TRANSPORTS 1
+         #define MAX_CHANGE_ONLY 2 // reporters given a deadband
 
          #define MAX_TITLE_LEN 20
          #define MAX_DEBUG_LEN 500
@@ -85,20 +85,24 @@ using namespace std::placeholders;
 
 // ESP32:
 
-         #define MAX_CONTROLS  20
-         #define MAX_REPORTERS 10
-         #define MAX_BURST     100
+         #define MAX_CONTROLS   20
+         #define MAX_REPORTERS  10
+         #define MAX_BURST      100
+         #define MAX_TRANSPORTS 3
+         #define MAX_CHANGE_ONLY MAX_REPORTERS
 
          #define MAX_TITLE_LEN 30
          #define MAX_DEBUG_LEN 1000
 
 #else
 
-// All else:
+// All else (and host builds):
 
-         #define MAX_CONTROLS  20
-         #define MAX_REPORTERS 10
-         #define MAX_BURST     10
+         #define MAX_CONTROLS   20
+         #define MAX_REPORTERS  10
+         #define MAX_BURST      10
+         #define MAX_TRANSPORTS 3
+         #define MAX_CHANGE_ONLY MAX_REPORTERS
 
          #define MAX_TITLE_LEN 30
          #define MAX_DEBUG_LEN 1000
@@ -106,8 +110,121 @@ using namespace std::placeholders;
 #endif
 
 // (conservative calculations:)
-#define MAX_BUFFER_LEN (1+8+MAX_TITLE_LEN+24*5+5+1) // 145 last time checked
+#define MAX_MODULE_LEN (1+8+MAX_TITLE_LEN+24*5+5+1) // 145 last time checked
+#define MAX_VALUES_LEN (2+MAX_CONTROLS*(24+1)+1)     // "#\r" and the controls' values
+#define MAX_BUFFER_LEN (MAX_MODULE_LEN > MAX_VALUES_LEN? MAX_MODULE_LEN : MAX_VALUES_LEN)
 #define MAX_BUILD_STRING_LEN (2+MAX_CONTROLS*(8+MAX_TITLE_LEN+3*24+5)+1) // 1903 last time checked
+#define MAX_RX_LEN 32 // longest incoming line, e.g. "12:-1234.567890\n"
+
+/* Adaptive rate */
+
+#define S302_CALM_REPORTS 4  // calm reports needed before speeding up ...
+#define S302_CALM_MAX     64 // ... doubling after each slow-down, up to this
+
+/* Idle time */
+
+#if defined S302_UNO
+#define MAX_IDLE_JOBS      4   // the library's own two, then yours
+#else
+#define MAX_IDLE_JOBS      8   // the library's own two (four with a recorder), then yours
+#endif
+#define S302_IDLE_PATIENCE 100 // steps the build string and debug jobs wait, then run late
+#define S302_BUILD_BUDGET  500 // (us) to format and queue a build string
+#define S302_DEBUG_BUDGET  100 // (us) to queue the debug messages
+#define S302_DOWNLOAD_BUDGET 500 // (us) to read a page back and queue it
+#define S302_FLUSH_BUDGET  500 // (us) to write a page to storage, unless addRecorder is told
+
+// transmit queue per transport, emptied in the idle time (not on the Uno)
+#if defined ESP32
+#define S302_TX_LEN 4096
+#else
+#define S302_TX_LEN 1024
+#endif
+
+typedef void (*S302IdleJob)(void* ctx);
+
+struct S302Job {
+   S302IdleJob fn;
+   void*       ctx;
+   uint32_t    budget;   // (us) the longest it takes
+   uint8_t     patience; // steps to pass it over before running it late (0: never)
+   uint8_t     skipped;  // steps in a row without the time for it
+};
+
+// (reporter subsets are bitmasks, so at most 32 reporters)
+#define S302_ALL_REPORTERS 0xFFFFFFFF
+
+// report period of a transport that only describes its reporters, e.g.
+// the reliable one beside S302UdpTransport
+#define S302_NO_REPORTS 0xFFFFFFFF
+
+// recordings per transport, in bytes (reporters take burst * their width)
+#define S302_RECORD_LEN (MAX_REPORTERS*MAX_BURST*4)
+
+/* Snapshot group */
+
+#define S302_SNAPSHOT_TRIES 4 // attempts per step at a whole copy
+
+// (the sampling side must read the counter in one go, so a byte on the
+// Uno, where only an interrupt can be half-way through an update)
+#if defined S302_UNO
+typedef uint8_t  S302_SEQ;
+#else
+typedef uint32_t S302_SEQ;
+#endif
+
+/* Flight recorder */
+
+#define S302_PAGE_LEN 256 // bytes handed to storage at a time (two buffered)
+
+/* Reporter types */
+
+// Kind in the top nibble, width in bytes in the bottom one
+#define S302_INT   0x00
+#define S302_UINT  0x10
+#define S302_FLOAT 0x20
+#define S302_BOOL  0x30
+
+template <class T>
+struct S302Type {
+   // (any integer)
+   static const uint8_t code = ((T)-1 < (T)0? S302_INT : S302_UINT) | sizeof(T);
+};
+template <> struct S302Type<float>  { static const uint8_t code = S302_FLOAT | sizeof(float); };
+template <> struct S302Type<double> { static const uint8_t code = S302_FLOAT | sizeof(double); };
+template <> struct S302Type<bool>   { static const uint8_t code = S302_BOOL | 1; };
+template <class T> struct S302Type<const T>    : S302Type<T> {};
+template <class T> struct S302Type<volatile T> : S302Type<T> {};
+
+/* One attached transport */
+
+struct S302Link {
+   void*          self;
+   const S302Ops* ops;
+   uint32_t       reporters;     // bitmask of the reporters sent over it
+   uint32_t       report_period; // its own report period
+   uint32_t       report_timer;
+   uint32_t       rp_min, rp_max; // adaptive bounds (rp_max 0 = fixed rate)
+   uint8_t        keep;           // share of each burst kept, out of 255
+   uint8_t        calm;           // reports in a row with room to spare
+   uint8_t        calm_needed;    // ... before speeding back up
+   int32_t        room_max;       // largest transmit room seen (= empty)
+   int32_t        waiting;        // bytes queued when the last report began
+   int32_t        queued;         // ... and once it was handed over
+   uint32_t       capacity;       // what the link was seen to carry, bytes/s
+   uint32_t       tx_bytes, tx_timer, bps; // measured throughput
+   uint32_t       unsent;         // change-only reporters owing a first sample
+   bool           build_due;      // asked for the build string
+#if !defined S302_UNO
+   uint8_t        tx[S302_TX_LEN]; // transmit queue (a ring) ...
+   uint16_t       tx_head, tx_tail;
+   bool           stalled;        // ... once took longer than a step to empty
+   int32_t        tx_room_max;    // the transport's own queue: largest room seen
+   int32_t        tx_pending;     // ... and what was in it at the last measurement
+#endif
+   char           rx[MAX_RX_LEN]; // incoming line, assembled byte by byte
+   uint8_t        rx_len;
+};
 
 /* Class definition! */
 
@@ -121,18 +238,41 @@ class CommManager {
 
       CommManager(uint32_t sp=1000, uint32_t rp=20000);
       
-#if defined S302_SERIAL
-#if defined TEENSYDUINO
-      void connect(usb_serial_class* s, uint32_t baud);
-#elif defined(ARDUINO_USB_MODE)
-      void connect(HWCDC* s, uint32_t baud);
-#else
-      void connect(HardwareSerial* s, uint32_t baud);
-#endif
-#elif defined S302_WEBSOCKETS
+      // Serial in one line, e.g. `connect(&Serial, 115200)`
+      template <class S>
+      void connect(S* s, uint32_t baud) {
+         s->begin(baud);
+         // Serial tends to fill with garbage for the first half-second
+         delay(500);
+         while( s->available() )
+            s->read();
+         _serial_link = S302SerialTransport(s);
+         addTransport(_serial_link);
+         connect();
+      }
+#if defined S302_WEBSOCKETS
       void connect(const char* ssid, const char* pw);
 #endif
 
+      // Or attach transports one by one (each with its own report period
+      // and subset of reporters, bit i = i-th reporter added), then
+      // call `connect()`. A report period of 0 means the one given above.
+      template <class T>
+      bool addTransport(
+         T& transport,
+         uint32_t report_period=0,
+         uint32_t reporters=S302_ALL_REPORTERS) {
+         return _add_link(&transport, &S302Policy<T>::ops,
+                          report_period, reporters);
+      }
+      void connect();
+
+      // Let a transport (numbered in the order added, from 0) trade burst
+      // and report period against what its link actually sustains
+      bool adapt(
+         uint8_t transport,
+         uint32_t rp_min, uint32_t rp_max);
+
 #if defined ESP32
       void pinToCore(uint8_t xCoreID = 0);
 #endif
@@ -165,23 +305,65 @@ class CommManager {
 
       /* To add reporters: */
 
+      // (any integer, float, double or bool, sent at its own width)
+
+      template <class T>
       bool addPlot(
-         float* linker,
+         T* linker,
          const char* title,
          float yrange_min, float yrange_max,
          uint8_t steps_displayed=10,
          uint8_t burst=1,
-         uint8_t num_plots=1);
-
-      bool addNumber(
-         int32_t* linker,
-         const char* title,
-         uint8_t burst=1);
+         uint8_t num_plots=1) {
+         return _add_plot((void*)linker, S302Type<T>::code, title,
+                          yrange_min, yrange_max,
+                          steps_displayed, burst, num_plots);
+      }
 
+      template <class T>
       bool addNumber(
-         float* linker,
+         T* linker,
          const char* title,
-         uint8_t burst=1);
+         uint8_t burst=1) {
+         return _add_number((void*)linker, S302Type<T>::code, title, burst);
+      }
+
+      /* To send a reporter only when it changes: */
+
+      // (by more than `deadband`, or at least every `max_interval`
+      // microseconds, 0 for never; `burst` caps samples per report)
+      bool deadband(
+         const void* linker,
+         float deadband,
+         uint32_t max_interval=1000000);
+
+      /* To sample several reporters from the same update: */
+
+      // Add a reporter to the snapshot group, then wrap every change to
+      // the group in beginUpdate() and endUpdate(). Neither side waits: a
+      // step that keeps catching an update half-done reuses the last
+      // whole snapshot.
+      bool snapshot(const void* linker);
+      void beginUpdate();
+      void endUpdate();
+
+#if !defined S302_UNO
+      /* To log reporters to storage at every step: */
+
+      // (the capture downloads over any transport afterwards, see docs;
+      // `flush_budget` is how long, in microseconds, storage takes to
+      // write a page, unused on the ESP32)
+      template <class S>
+      bool addRecorder(
+         S& storage,
+         uint32_t reporters=S302_ALL_REPORTERS,
+         uint32_t flush_budget=S302_FLUSH_BUDGET) {
+         return _add_recorder(&storage, &S302StoragePolicy<S>::ops, reporters,
+                              flush_budget);
+      }
+      bool record(bool on);      // start a new capture, or finish this one
+      uint32_t recordsDropped(); // (when storage fell behind)
+#endif
 
       /* Tick */
 
@@ -190,6 +372,13 @@ class CommManager {
       void _step();
 #endif
       uint32_t headroom();
+      uint32_t throughput(uint8_t transport=0); // bytes per second
+
+      // Run `job(ctx)` after each step's own work, when at least `budget`
+      // microseconds are left before the next step is due (or, given a
+      // `patience`, after that many steps without, making the next late)
+      bool addIdleJob(S302IdleJob job, void* ctx, uint32_t budget,
+                      uint8_t patience=0);
 
       /* Other */
       
@@ -213,31 +402,69 @@ class CommManager {
 
       /* Burst mechanic */
 
-      uint8_t _recordings[MAX_REPORTERS][MAX_BURST][4];
-      uint8_t _bursts[MAX_REPORTERS];
+      uint8_t  _recordings[MAX_TRANSPORTS][S302_RECORD_LEN];
+      uint16_t _slots[MAX_REPORTERS]; // where each reporter's recordings start
+      uint16_t _slots_used;
+      uint8_t  _bursts[MAX_REPORTERS];
+
+      /* Change-only reporters */
+
+      // (indexed by _change_only[reporter] - 1, 0 for a plain reporter)
+      uint8_t  _change_only[MAX_REPORTERS]; uint8_t _total_change_only;
+      float    _deadbands[MAX_CHANGE_ONLY];
+      uint32_t _max_intervals[MAX_CHANGE_ONLY];
+      uint16_t _offsets[MAX_TRANSPORTS][MAX_CHANGE_ONLY][MAX_BURST]; // sample times
+      uint8_t  _counts[MAX_TRANSPORTS][MAX_CHANGE_ONLY];   // samples so far
+      double   _last_values[MAX_TRANSPORTS][MAX_CHANGE_ONLY];
+      uint32_t _last_times[MAX_TRANSPORTS][MAX_CHANGE_ONLY];
+
+      /* Snapshot group (a seqlock) */
+
+      uint32_t      _grouped;                // reporters in the group
+      volatile S302_SEQ _seq;                // odd while being updated
+      uint64_t      _snapshots[MAX_REPORTERS]; // the group's last whole copy
+
+#if !defined S302_UNO
+      /* Flight recorder */
+
+      void*                 _store;
+      const S302StorageOps* _store_ops;
+      uint32_t _rec_reporters;
+      uint8_t  _rec_len;              // bytes per record
+      volatile bool _rec_on;          // (asked for)
+      bool     _rec_active;           // (step's side of it)
+      volatile bool _rec_ending;      // last page handed over, then close
+      uint8_t  _pages[2][S302_PAGE_LEN];
+      volatile uint16_t _page_len[2];
+      volatile bool     _page_full[2]; // waiting for storage
+      uint8_t  _page, _page_next;     // being filled, to be written next
+      uint32_t _rec_dropped;
+      uint8_t  _download_to;          // link + 1, 0 for none
+      uint32_t _download_pos;
+#if defined ESP32
+      TaskHandle_t _rec_task;
+#endif
+#endif
+
+      /* Where each reporter sits in the build string */
+
+      uint16_t _spans[MAX_REPORTERS][2];
 
       /* Links */
 
       float*  _controls[MAX_CONTROLS];   uint8_t _total_controls;
-      float*  _reporters[MAX_REPORTERS]; uint8_t _total_reporters;
+      void*   _reporters[MAX_REPORTERS]; uint8_t _total_reporters;
+      uint8_t _types[MAX_REPORTERS]; // S302Type codes
 
       /* Remember the inputs' types */
       bool _ctrl_types[MAX_CONTROLS];
 
-#if defined S302_SERIAL
-#if defined TEENSYDUINO
-      usb_serial_class* _serial;
-#elif defined(ARDUINO_USB_MODE)
-      HWCDC* _serial;
-#else
-      HardwareSerial* _serial;
-#endif
-      uint32_t _baud;
-#elif defined S302_WEBSOCKETS
-      WebSocketsServer _wss = WebSocketsServer(S302_PORT);
-      void _on_websocket_event(
-         uint8_t num, WStype_t type,
-         uint8_t* payload, size_t length);
+      /* Transports */
+
+      S302Link _links[MAX_TRANSPORTS]; uint8_t _total_links;
+      S302SerialTransport _serial_link;
+#if defined S302_WEBSOCKETS
+      S302WebSocketsTransport _ws_link;
 #endif
       
       /* Timing */
@@ -248,13 +475,16 @@ class CommManager {
       int32_t  _headroom;                       // headroom for the last step
       float    _headroom_rp = (float)INT32_MAX; // lowest headroom over the
                                                 // last report period
+      /* Idle jobs */
+
+      S302Job  _jobs[MAX_IDLE_JOBS];
+      uint8_t  _total_jobs;
+      bool     _debug_due; // (once per report period)
 
 #if defined TEENSYDUINO
       elapsedMicros _main_timer;
-      elapsedMicros _report_timer;
 #else
       uint32_t _main_timer;
-      uint32_t _report_timer;
 #endif
 #if defined ESP32
       uint32_t _secondary_timer;
@@ -268,11 +498,60 @@ class CommManager {
       
       /* Routines */
 
+      bool _add_link(void* self, const S302Ops* ops,
+                     uint32_t report_period, uint32_t reporters);
+      bool _can_report(uint8_t burst, uint8_t type);
+#if !defined S302_UNO
+      bool _add_recorder(void* self, const S302StorageOps* ops,
+                         uint32_t reporters, uint32_t flush_budget);
+      void _rec_step(uint32_t now);
+      void _rec_put(const void* data, uint8_t len);
+      void _rec_flush();
+      void _download();
+      static void _flush_job(void* self);
+      static void _download_job(void* self);
+#if defined ESP32
+      static void _rec_walk(void* param);
+#endif
+#endif
+      bool _add_plot(void* linker, uint8_t type, const char* title,
+                     float yrange_min, float yrange_max,
+                     uint8_t steps_displayed, uint8_t burst,
+                     uint8_t num_plots);
+      bool _add_number(void* linker, uint8_t type, const char* title,
+                       uint8_t burst);
+      void _add_reporter(void* linker, uint8_t type, uint8_t burst);
+      void _type_name(uint8_t type, char* name);
       void _control();
-      void _record(uint8_t reporter);
-      void _report();
-      bool _time_to_talk(uint32_t time_to_wait);
+      void _parse(uint8_t link);
+      void _send_build_string(uint8_t link);
+      uint8_t _burst(uint8_t link, uint8_t reporter);
+      uint8_t _ts_shift(uint8_t link);
+      void    _snapshot();
+      const void* _source(uint8_t reporter);
+      double  _value(uint8_t reporter);
+      uint16_t _block_size(uint8_t type, uint8_t count);
+      size_t  _send_samples(uint8_t link, uint8_t reporter, uint8_t count);
+      void _record(uint8_t reporter, uint32_t now);
+      void _report(uint8_t link);
+      uint16_t _report_size(uint8_t link);
+      void _adapt(uint8_t link, bool congested, bool calm);
+      bool _slower(uint8_t link);
+      bool _faster(uint8_t link);
+      bool _time_to_talk(uint8_t link);
       void _wait();
+      void _idle();
+      int32_t _time_left();
+      int32_t _room(uint8_t link);
+      static void _build_job(void* self);
+      static void _debug_job(void* self);
+      void _send_builds();
+      void _send_debug();
+#if !defined S302_UNO
+      size_t _queue(uint8_t link, const uint8_t* msg, size_t len);
+      bool _drain(uint8_t link, bool block);
+      uint16_t _tx_used(uint8_t link);
+#endif
       
       void _NOT_IMPLEMENTED_YET();
 
@@ -0,0 +1,364 @@
+#include <Six302.h>
+#include <new>
+#if !defined ARDUINO
+#include <chrono>
+#if defined __GLIBC__
+#include <malloc.h>
+#endif
+#endif
+
+/* Times the library's hot paths: adding modules, sending the build
+   string, a step with nothing to send, a step that reports, and a step
+   that parses a control message. It sweeps the number of reporters, their
+   burst and the number of controls, and prints one row per set-up:
+
+      reporters burst controls | add(ns) | build(ns) bytes | step(ns)
+         | report(ns) bytes | control(ns) | size(B) heap(B) stack(B)
+
+   Reports go to a transport that only counts the bytes, so the link's
+   speed doesn't count. Each step is timed from the call to an idle job
+   that runs after the library's own, so the wait at the end of the step
+   isn't counted, on the finest clock there is: nanoseconds on a
+   computer, CPU cycles on the ESPs, micros() elsewhere. Times are summed
+   over batches of STEPS steps (REPORTS reports), less what reading the
+   clock costs, and the best of ROUNDS batches is kept. Heap is what the
+   library allocated (the ESPs, or glibc's count on a computer), stack
+   the deepest the benchmark went (the ESP32's loop task, or below a
+   painted stretch of the stack on a computer).
+
+   Rows are compared with BASELINE. Its build string and report sizes must
+   match exactly. Its step, report and control times may be exceeded by
+   MARGIN percent. A row that's only too slow is measured again, up to
+   RETRIES times, since anything else running on the board (or computer)
+   slows it too. Rows that still fail are marked FAIL, and the last line
+   says PASS or FAIL. After a change that's meant to be slower or bigger,
+   paste the printed `{ ... },` lines into the table. Columns that are
+   zero there are only printed.
+
+   The table is for a host build (extras/host, `make check`), which exits
+   with the number of failures instead of looping. On a board, paste its
+   own numbers in the zeroed table under ARDUINO. */
+
+// microseconds (a step's wait isn't timed, so these only set the pace)
+#if defined ESP32
+#define STEP_TIME   100
+#define REPORT_TIME 10000
+#else
+#define STEP_TIME   1
+#define REPORT_TIME 200
+#endif
+
+#define ROUNDS      20   // batches per set-up, keeping the best
+#define REPORTS     40   // reports timed per batch
+#define STEPS       1000 // steps timed per batch, for the averages
+#define MARGIN      50   // percent
+#define RETRIES     3    // more tries for a row that's too slow
+
+/* The finest clock there is, in ticks that wrap (take differences) */
+
+#if !defined ARDUINO
+#define TICKS_PER_US 1000
+uint32_t ticks() {
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#elif defined ESP32 || defined ESP8266
+#define TICKS_PER_US ESP.getCpuFreqMHz()
+uint32_t ticks() { return ESP.getCycleCount(); }
+#else
+#define TICKS_PER_US 1
+#define COARSE_CLOCK
+uint32_t ticks() { return micros(); }
+#endif
+
+uint32_t ns(int64_t t) {
+   return t > 0? t * 1000 / TICKS_PER_US : 0;
+}
+
+/* A transport that only counts what's sent, and hands out one message */
+
+struct Sink {
+   const char* in;
+   uint32_t written, built; // (built: where the build string started)
+   size_t write(const uint8_t* buf, size_t len) {
+      if( len >= 2 && buf[0] == '\f' && buf[1] == 'B' )
+         built = written;
+      written += len;
+      return len;
+   }
+   int available() { return in && *in? 1 : 0; }
+   int read() { return in && *in? *in++ : -1; }
+   void loop() {}
+   int availableForWrite() { return -1; }
+};
+
+struct Setup    { uint8_t reporters, burst, controls; };
+struct Baseline { uint32_t step, report, control, build_bytes, report_bytes; };
+
+const Setup SETUPS[] = {
+   { 1,             1,             1 },
+   { 1,             MAX_BURST,     1 },
+   { MAX_REPORTERS, 1,             1 },
+   { MAX_REPORTERS, MAX_BURST,     1 },
+   { MAX_REPORTERS, MAX_BURST,     MAX_CONTROLS },
+};
+#define N_SETUPS (sizeof(SETUPS) / sizeof(SETUPS[0]))
+
+// (ns per step, per step that reports, per step that parses a control
+// message, then bytes per build string and per report, in SETUPS' order)
+#if !defined ARDUINO
+// x86-64, g++ -O2 (one core of a virtual machine, whose best times
+// still wander by a third between runs, hence the margin)
+const Baseline BASELINE[N_SETUPS] = {
+   {   190,    420,    270,   102,    18 },
+   {   190,    420,    270,   103,    54 },
+   {   240,    600,    325,   489,    63 },
+   {   230,    590,    325,   499,   423 },
+   {   230,    600,    330,  1506,   423 },
+};
+#else
+// (zeros until it's been measured on the board)
+const Baseline BASELINE[N_SETUPS] = {
+   {     0,      0,      0,     0,     0 },
+   {     0,      0,      0,     0,     0 },
+   {     0,      0,      0,     0,     0 },
+   {     0,      0,      0,     0,     0 },
+   {     0,      0,      0,     0,     0 },
+};
+#endif
+
+// (a CommManager counts on starting out zeroed, as a global does)
+alignas(CommManager) uint8_t arena[sizeof(CommManager)];
+
+Sink sink;
+float values[MAX_REPORTERS > MAX_CONTROLS? MAX_REPORTERS : MAX_CONTROLS];
+
+void column(uint32_t v, uint8_t width) {
+   char buf[12];
+   ultoa(v, buf, 10);
+   for( uint8_t i = strlen(buf); i < width; i++ )
+      Serial.print(" ");
+   Serial.print(buf);
+}
+
+bool fast_enough(uint32_t measured, uint32_t baseline) {
+   return !baseline
+       || (uint64_t)measured * 100 <= (uint64_t)baseline * (100 + MARGIN);
+}
+
+bool same(uint32_t measured, uint32_t baseline) {
+   return !baseline || measured == baseline;
+}
+
+bool sized(const Baseline& m, const Baseline& b) {
+   return same(m.build_bytes, b.build_bytes)
+       && same(m.report_bytes, b.report_bytes);
+}
+
+bool timed(const Baseline& m, const Baseline& b) {
+   return fast_enough(m.step, b.step)
+       && fast_enough(m.report, b.report)
+       && fast_enough(m.control, b.control);
+}
+
+// micros() counts whole microseconds from the end of the last wait,
+// which ends right on a tick. Spending a random fraction of a microsecond
+// first makes the rounding average out.
+uint32_t spins_per_us;
+void jitter() {
+#if defined COARSE_CLOCK
+   for( volatile uint32_t i = random(spins_per_us); i; i-- );
+#endif
+}
+
+// (when the idle jobs before this one were done)
+uint32_t idle_done;
+void stamp(void* ctx) {
+   idle_done = ticks();
+}
+
+// Ticks from the call to the stamp, less a clock reading's own
+uint32_t clock_cost;
+int32_t timed_step(CommManager* cm) {
+   jitter();
+   uint32_t t = ticks();
+   cm->step();
+   return (int32_t)(idle_done - t - clock_cost);
+}
+
+/* Memory (computer) */
+
+#if !defined ARDUINO
+uint32_t heap_now() {
+#if defined __GLIBC__
+   return mallinfo2().uordblks;
+#else
+   return 0;
+#endif
+}
+
+// Fill a stretch of stack below the caller with a pattern, and later
+// find how far down it's been overwritten
+#define PAINT_LEN 65536
+volatile uint8_t* painted;
+__attribute__((noinline)) void paint_stack() {
+   volatile uint8_t stretch[PAINT_LEN];
+   for( uint32_t i = 0; i < PAINT_LEN; i++ )
+      stretch[i] = 0xA5;
+   painted = stretch;
+}
+__attribute__((noinline)) uint32_t stack_depth() {
+   uint32_t i = 0;
+   while( i < PAINT_LEN && painted[i] == 0xA5 )
+      i++;
+   return PAINT_LEN - i;
+}
+#endif
+
+Baseline bench(const Setup& s) {
+#if defined ARDUINO && (defined ESP32 || defined ESP8266)
+   uint32_t heap = ESP.getFreeHeap();
+#elif !defined ARDUINO
+   uint32_t heap = heap_now();
+   paint_stack();
+#endif
+   memset(arena, 0, sizeof(arena));
+   CommManager* cm = new (arena) CommManager(STEP_TIME, REPORT_TIME);
+   sink.in = NULL;
+   sink.written = 0;
+
+   /* Adding modules */
+   uint32_t t = ticks();
+   for( uint8_t i = 0; i < s.controls; i++ )
+      cm->addSlider(&values[i], "Control", -1, 1, 0.01);
+   for( uint8_t i = 0; i < s.reporters; i++ )
+      cm->addPlot(&values[i], "Reporter", -1, 1, 10, s.burst);
+   uint32_t add_ns = ns((int32_t)(ticks() - t - clock_cost)) / (s.controls + s.reporters);
+   cm->addTransport(sink);
+   cm->addIdleJob(stamp, NULL, 0);
+   cm->connect();
+
+   /* The build string, which waits for an idle time with room for it */
+   int64_t build_ticks = 0;
+   uint32_t build_bytes = 0;
+   for( uint8_t i = 0; i < 10; i++ ) {
+      sink.in = "\n";
+      sink.built = UINT32_MAX;
+      int32_t took;
+      do {
+         sink.written = 0;
+         took = timed_step(cm);
+      } while( sink.built == UINT32_MAX );
+      build_ticks += took;
+      build_bytes = sink.written - sink.built;
+   }
+   uint32_t build_ns = ns(build_ticks) / 10;
+
+   /* Steps, some of which report, then steps that each parse a control
+      message. Best of ROUNDS, as anything else running only slows them. */
+   uint32_t step_ns = UINT32_MAX, report_ns = UINT32_MAX, report_bytes = 0;
+   uint32_t control_ns = UINT32_MAX;
+   static char msg[MAX_RX_LEN];
+   for( uint8_t round = 0; round < ROUNDS; round++ ) {
+      uint32_t steps = 0, reports = 0;
+      int64_t step_ticks = 0, report_ticks = 0;
+      while( reports < REPORTS || steps < STEPS ) {
+         sink.written = 0;
+         int32_t took = timed_step(cm);
+         if( sink.written ) {
+            reports++;
+            report_ticks += took;
+            report_bytes = sink.written;
+         } else {
+            steps++;
+            step_ticks += took;
+         }
+      }
+      step_ns = min(step_ns, ns(step_ticks) / steps);
+      report_ns = min(report_ns, ns(report_ticks) / reports);
+
+      uint32_t controls = 0;
+      int64_t control_ticks = 0;
+      while( controls < STEPS ) {
+         sprintf(msg, "%d:0.5\n", (int)(controls % s.controls));
+         sink.in = msg;
+         sink.written = 0;
+         int32_t took = timed_step(cm);
+         if( sink.written ) continue; // (reported too)
+         controls++;
+         control_ticks += took;
+      }
+      control_ns = min(control_ns, ns(control_ticks) / controls);
+   }
+
+   /* Memory */
+   uint32_t heap_used = 0, stack_used = 0;
+#if defined ARDUINO && (defined ESP32 || defined ESP8266)
+   heap_used = heap - ESP.getFreeHeap();
+#endif
+#if defined ESP32
+   stack_used = 8192 - uxTaskGetStackHighWaterMark(NULL);
+#elif !defined ARDUINO
+   heap_used = heap_now() - heap;
+   stack_used = stack_depth();
+#endif
+   cm->~CommManager();
+
+   /* Row */
+   column(s.reporters, 3); column(s.burst, 4); column(s.controls, 4);
+   Serial.print(" |"); column(add_ns, 7);
+   Serial.print(" |"); column(build_ns, 8); column(build_bytes, 6);
+   Serial.print(" |"); column(step_ns, 7);
+   Serial.print(" |"); column(report_ns, 8); column(report_bytes, 6);
+   Serial.print(" |"); column(control_ns, 7);
+   Serial.print(" |"); column(sizeof(CommManager), 7); column(heap_used, 6); column(stack_used, 6);
+
+   Baseline measured = { step_ns, report_ns, control_ns, build_bytes, report_bytes };
+   return measured;
+}
+
+void setup() {
+   Serial.begin(115200);
+   delay(500);
+
+   Serial.println(" rep burst ctl |  add ns | build ns bytes | step ns | report ns bytes | ctl ns |  size B  heap stack");
+   uint32_t t = micros();
+   for( volatile uint32_t i = 100000; i; i-- );
+   spins_per_us = 100000 / max((uint32_t)1, (uint32_t)(micros() - t));
+   clock_cost = UINT32_MAX;
+   for( uint16_t i = 0; i < 1000; i++ ) {
+      t = ticks();
+      clock_cost = min(clock_cost, (uint32_t)(ticks() - t));
+   }
+   uint8_t failures = 0;
+   Baseline measured[N_SETUPS];
+   for( uint8_t row = 0; row < N_SETUPS; row++ )
+      for( uint8_t tries = 0; ; tries++ ) {
+         measured[row] = bench(SETUPS[row]);
+         bool size_ok = sized(measured[row], BASELINE[row]);
+         bool ok = size_ok && timed(measured[row], BASELINE[row]);
+         if( ok || !size_ok || tries == RETRIES ) { // (sizes don't vary)
+            failures += !ok;
+            Serial.println(ok? "" : "  FAIL");
+            break;
+         }
+         Serial.println("  (again)");
+      }
+
+   // (for BASELINE)
+   Serial.println();
+   for( uint8_t row = 0; row < N_SETUPS; row++ ) {
+      Serial.print("   {");
+      column(measured[row].step, 6); Serial.print(",");
+      column(measured[row].report, 7); Serial.print(",");
+      column(measured[row].control, 7); Serial.print(",");
+      column(measured[row].build_bytes, 6); Serial.print(",");
+      column(measured[row].report_bytes, 6); Serial.println(" },");
+   }
+   Serial.println(failures? "FAIL" : "PASS");
+#if !defined ARDUINO
+   exit(failures);
+#endif
+}
+
+void loop() {}
@@ -0,0 +1,50 @@
+#include <Six302.h>
+#include <S302FlashStorage.h>
+#include <LittleFS.h>
+
+/* Logs a fast sine wave to flash at every step while the GUI only gets a
+   slow report. Turn on "Record" for a while, turn it off, then press
+   "Download capture" in the GUI's CSV controls. ESP32 or ESP8266.
+
+   Flash is written a page at a time, off the step (from its own task on
+   the ESP32, in the step's spare time on the ESP8266). */
+
+// microseconds
+#define STEP_TIME 1000
+#define REPORT_TIME 100000
+
+CommManager cm(STEP_TIME, REPORT_TIME);
+
+S302FlashStorage flash(LittleFS, "/capture.bin");
+
+float t;
+float output;
+bool recording;
+bool was_recording;
+
+void setup() {
+#ifdef ESP32
+   LittleFS.begin(true); // (formats on first use)
+#else
+   LittleFS.begin();
+#endif
+
+   /* Add modules */
+   cm.addToggle(&recording, "Record");
+   cm.addPlot(&output, "Output", -1.1, 1.1); // reporter 0
+
+   /* Log the output at every step */
+   cm.addRecorder(flash, 1UL << 0);
+
+   /* Ready to communicate over serial */
+   cm.connect(&Serial, 115200);
+}
+
+void loop() {
+   output = sin(t += 0.01);
+   if( recording != was_recording ) {
+      cm.record(recording);
+      was_recording = recording;
+   }
+   cm.step();
+}
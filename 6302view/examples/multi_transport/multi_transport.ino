@@ -0,0 +1,53 @@
+
+#include <Six302.h>
+#include <S302WebSockets.h>
+
+/* Streams a fast plot over USB while a WiFi dashboard gets a slower
+   report of just the number. ESP32 or ESP8266 only.
+
+   Each transport has its own report period and its own subset of
+   reporters: bit 0 is the first reporter added, bit 1 the second, ...
+
+   Leave S302_VERBOSE undefined here: it prints WebSockets events to
+   Serial, which is carrying the GUI's reports. */
+
+// microseconds
+#define STEP_TIME 1000
+#define REPORT_TIME 10000
+
+CommManager cm(STEP_TIME, REPORT_TIME);
+
+S302SerialTransport usb(&Serial);
+S302WebSocketsTransport ws(80);
+
+float input;
+float output;
+int32_t count;
+
+void setup() {
+   Serial.begin(115200);
+
+   /* Add modules */
+   cm.addSlider(&input, "Input", -5, 5, 0.1);
+   cm.addPlot(&output, "Output", -1, 30, 10, 10); // reporter 0
+   cm.addNumber(&count, "Count");                  // reporter 1
+
+   /* Join the network */
+   WiFi.begin("MY NETWORK", "MY PASSWORD");
+   while( WiFi.status() != WL_CONNECTED )
+      delay(500);
+   ws.begin();
+
+   /* Everything over USB, every 10 ms */
+   cm.addTransport(usb);
+   /* Only the count over WiFi, every 500 ms */
+   cm.addTransport(ws, 500000, 1UL << 1);
+
+   cm.connect();
+}
+
+void loop() {
+   output = input * input;
+   count++;
+   cm.step();
+}
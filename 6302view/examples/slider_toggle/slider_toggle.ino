@@ -1,10 +1,7 @@
 
 #include <Six302.h>
 
-/* For this demo, make sure to have the `#define S302_SERIAL`
-   macro enabled in the library. 
-
-   This demo presents a slider that alternates between -1
+/* This demo presents a slider that alternates between -1
    and +1 */
 
 // microseconds
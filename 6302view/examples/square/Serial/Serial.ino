@@ -1,7 +1,5 @@
 
-/* For this demo, make sure the `#define S302_SERIAL` macro
-   is chosen in the library. This demo should compile on the Teensy,
-   ESP32, and ESP8266. */
+/* This demo should compile on the Teensy, ESP32, and ESP8266. */
 
 #include <Six302.h>
 
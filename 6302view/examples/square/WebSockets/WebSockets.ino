@@ -1,15 +1,17 @@
 
 #include <Six302.h>
+#include <S302WebSockets.h>
 
-/* For this demo, make sure to have the `#define S302_WEBSOCKETS`
-   macro enabled in the library, and to use either an ESP32 or
-   an ESP8266. */
+/* For this demo, use either an ESP32 or an ESP8266, and have the
+   `WebSockets` library installed. (Defining `S302_WEBSOCKETS` in the
+   library and calling `cm.connect("ssid", "p/w")` still works too.) */
 
 // microseconds
 #define STEP_TIME 100000
 #define REPORT_TIME 500000
 
 CommManager cm(STEP_TIME, REPORT_TIME);
+S302WebSocketsTransport ws(80);
 
 float input;
 float output;
@@ -22,11 +24,19 @@ void setup() {
    cm.addSlider(&input, "Input", -5, 5, 0.1);
    cm.addPlot(&output, "Output", -1, 30);
 
+   /* Join the network */
+   WiFi.begin("MY NETWORK", "MY PASSWORD");
+   while( WiFi.status() != WL_CONNECTED )
+      delay(500);
+   Serial.println(WiFi.localIP());
+
    /* Ready to communicate over websockets */
-   cm.connect("MY NETWORK", "MY PASSWORD");
+   ws.begin();
+   cm.addTransport(ws);
+   cm.connect();
 }
 
 void loop() {
    output = input * input;
    cm.step();
-}
\ No newline at end of file
+}
@@ -0,0 +1,58 @@
+#include <Six302.h>
+#include <S302Udp.h>
+#if defined ESP32
+#include <WiFi.h>
+#else
+#include <ESP8266WiFi.h>
+#endif
+#include <WiFiUdp.h>
+
+/* Streams a fast plot by UDP, for the lowest latency, while the build
+   string, the slider and pings go over USB. ESP32 or ESP8266 only.
+
+   Run the bridge with the board's address (printed below), e.g.
+
+      python3 local_server.py --udp 10.0.0.18
+
+   A report lost on the way is skipped rather than sent again. */
+
+// microseconds
+#define STEP_TIME 1000
+#define REPORT_TIME 10000
+
+CommManager cm(STEP_TIME, REPORT_TIME);
+
+S302SerialTransport usb(&Serial);
+S302UdpTransport<WiFiUDP> udp; // port 6303
+
+float input = 1;
+float output;
+int32_t count;
+
+void setup() {
+   Serial.begin(115200);
+
+   /* Add modules */
+   cm.addSlider(&input, "Amplitude", 0, 5, 0.1);
+   cm.addPlot(&output, "Output", -5, 5, 10);
+   cm.addNumber(&count, "Count");
+
+   /* Join the network */
+   WiFi.begin("MY NETWORK", "MY PASSWORD");
+   while( WiFi.status() != WL_CONNECTED )
+      delay(500);
+   Serial.println(WiFi.localIP());
+   udp.begin();
+
+   /* Describe the reporters over USB, report them by UDP */
+   cm.addTransport(usb, S302_NO_REPORTS);
+   cm.addTransport(udp);
+
+   cm.connect();
+}
+
+void loop() {
+   output = input * sin(count * 0.01);
+   count++;
+   cm.step();
+}
@@ -0,0 +1,11 @@
+/* Reach out to almonds@mit.edu or jodalyst@mit.edu for help */
+
+#include "Arduino.h"
+
+HardwareSerial Serial;
+
+int main() {
+   setup();
+   for(;;)
+      loop();
+}
@@ -0,0 +1,118 @@
+/* Reach out to almonds@mit.edu or jodalyst@mit.edu for help */
+
+#ifndef _S302_HOST_Arduino_H_
+#define _S302_HOST_Arduino_H_
+
+/* Host stand-ins
+
+   Just enough of the Arduino core to build the library and a sketch on a
+   computer (see the Makefile here). ARDUINO stays undefined, so the
+   library takes its host configuration: the bigger boards' limits, and
+   the host-only transports and storage.
+
+   Time is the computer's steady clock. Serial writes to stdout and never
+   has anything to read. Arduino.cpp supplies main(), which calls setup()
+   once and then loop() forever; a sketch that's a test calls exit(). */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+/* Time */
+
+inline uint32_t micros() {
+   static std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+   return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+}
+inline uint32_t millis() { return micros() / 1000; }
+
+// (spins, as on a board: sleeping would oversleep by tens of microseconds)
+inline void delayMicroseconds(uint32_t us) {
+   uint32_t start = micros();
+   while( micros() - start < us );
+}
+inline void delay(uint32_t ms) {
+   std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+/* Numbers */
+
+#define constrain(amt, low, high) \
+   ((amt) < (low)? (low) : ((amt) > (high)? (high) : (amt)))
+
+inline long random(long n) { return n > 0? rand() % n : 0; }
+
+inline char* dtostrf(double v, signed char width, unsigned char prec, char* buf) {
+   sprintf(buf, "%*.*f", width, prec, v);
+   return buf;
+}
+inline char* itoa(int v, char* buf, int) { sprintf(buf, "%d", v); return buf; }
+inline char* ultoa(unsigned long v, char* buf, int) { sprintf(buf, "%lu", v); return buf; }
+
+/* Streams */
+
+class Print {
+   public:
+      virtual ~Print() {}
+      virtual size_t write(uint8_t c) = 0;
+      virtual size_t write(const uint8_t* buf, size_t len) {
+         for( size_t i = 0; i < len; i++ )
+            write(buf[i]);
+         return len;
+      }
+      size_t print(const char* s)   { return write((const uint8_t*)s, strlen(s)); }
+      size_t print(char c)          { return write((uint8_t)c); }
+      size_t println(const char* s) { return print(s) + print("\n"); }
+      size_t println()              { return print("\n"); }
+};
+
+class Stream : public Print {
+   public:
+      virtual int available() = 0;
+      virtual int read() = 0;
+      virtual int peek() { return -1; }
+      virtual int availableForWrite() { return -1; }
+};
+
+class HardwareSerial : public Stream {
+   public:
+      void   begin(uint32_t baud) {}
+      size_t write(uint8_t c) { return fputc(c, stdout) == EOF? 0 : 1; }
+      size_t write(const uint8_t* buf, size_t len) { return fwrite(buf, 1, len, stdout); }
+      int    available() { return 0; }
+      int    read()      { return -1; }
+      operator bool()    { return true; }
+};
+
+extern HardwareSerial Serial;
+
+class String {
+   public:
+      String(const char* s = "") : _s(s) {}
+      int  length() const { return _s.size(); }
+      void toCharArray(char* buf, int len) const {
+         strncpy(buf, _s.c_str(), len);
+         buf[len - 1] = '\0';
+      }
+   protected:
+      std::string _s;
+};
+
+/* Sketch */
+
+void setup();
+void loop();
+
+#endif
@@ -0,0 +1,132 @@
+/* Reach out to almonds@mit.edu or jodalyst@mit.edu for help */
+
+#include <Six302.h>
+
+/* Convergence test for `cm.adapt`, host only
+
+   Over a loopback transport throttled like a slow link, five plots ask
+   for far more than the link carries. After SETTLE seconds, for MEASURE
+   seconds more:
+
+      slow  the bytes that arrive, and `cm.throughput`, are between
+            FILL percent of LINK_BPS and LINK_BPS (plus a queue's worth),
+            and the reports have backed off from the fastest rate
+      fast  with the throttle lifted, reports are back at the shortest
+            period with full bursts
+
+   It prints what it saw per phase, then PASS or FAIL. With `make check`,
+   it exits with the number of failures. */
+
+// microseconds
+#define STEP_TIME  1000
+#define RP_MIN     5000
+#define RP_MAX     400000
+
+#define PLOTS      5
+#define BURST      5
+#define LINK_BPS   2000 // bytes per second
+#define FILL       70   // percent of it used, at least
+#define SETTLE     6    // seconds
+#define MEASURE    3    // seconds
+
+CommManager cm(STEP_TIME, RP_MIN);
+S302LoopbackTransport wire;
+
+float values[PLOTS];
+
+/* What arrives, read back frame by frame */
+
+uint8_t  rx[2048];
+uint16_t rx_len;
+uint32_t arrived, reports, last_period, last_burst;
+
+void receive() {
+   rx_len += wire.drain(rx + rx_len, sizeof(rx) - rx_len);
+   uint16_t p = 0;
+   for(;;) {
+      while( p + 1 < rx_len && !(rx[p] == '\f' && rx[p + 1] == 'R') )
+         p++;
+      uint16_t q = p + 2 + 4 + 4 + 1; // (header)
+      uint8_t burst = 0;
+      for( uint8_t i = 0; i < PLOTS && q < rx_len; i++ ) {
+         burst = rx[q];
+         q += 1 + 4 * burst;
+      }
+      if( q + 2 > rx_len )
+         break; // (not all here yet)
+      memcpy(&last_period, rx + p + 2, 4);
+      last_burst = burst;
+      arrived += q + 2 - p;
+      reports++;
+      p = q + 2;
+   }
+   memmove(rx, rx + p, rx_len - p);
+   rx_len -= p;
+}
+
+/* Runs for a while, then measures */
+
+void run(uint32_t seconds) {
+   uint32_t start = millis();
+   while( millis() - start < seconds * 1000 ) {
+      for( uint8_t i = 0; i < PLOTS; i++ )
+         values[i] = sin(millis() * 0.001 + i);
+      cm.step();
+      receive();
+   }
+}
+
+uint8_t failures;
+
+void expect(bool ok, const char* what) {
+   Serial.print(ok? "   ok    " : "   FAIL  ");
+   Serial.println(what);
+   failures += !ok;
+}
+
+void print(const char* name, uint32_t v) {
+   char buf[12];
+   Serial.print(name);
+   ultoa(v, buf, 10);
+   Serial.print(buf);
+}
+
+void setup() {
+   Serial.begin(115200);
+
+   for( uint8_t i = 0; i < PLOTS; i++ )
+      cm.addPlot(&values[i], "Value", -1, 1, 10, BURST);
+   cm.addTransport(wire);
+   cm.adapt(0, RP_MIN, RP_MAX);
+   cm.connect();
+
+   /* Slow link */
+   wire.throttle(LINK_BPS);
+   run(SETTLE);
+   arrived = reports = 0;
+   run(MEASURE);
+   uint32_t bps = arrived / MEASURE;
+   uint32_t most = LINK_BPS + S302_LOOPBACK_LEN / MEASURE;
+   print("slow: ", bps); print(" B/s arrived, throughput ", cm.throughput(0));
+   print(" B/s, period ", last_period); print(" us, burst ", last_burst);
+   Serial.println();
+   expect(bps <= most && bps >= LINK_BPS * FILL / 100, "arrived within the link's rate");
+   expect(cm.throughput(0) <= most && cm.throughput(0) >= LINK_BPS * FILL / 100,
+          "throughput() agrees");
+   expect(last_period > RP_MIN || last_burst < BURST, "backed off");
+
+   /* Fast link */
+   wire.throttle(0);
+   run(SETTLE);
+   reports = 0;
+   run(MEASURE);
+   print("fast: ", reports / MEASURE); print(" reports/s, period ", last_period);
+   print(" us, burst ", last_burst);
+   Serial.println();
+   expect(last_period == RP_MIN && last_burst == BURST, "back at the fastest rate");
+
+   Serial.println(failures? "FAIL" : "PASS");
+   exit(failures);
+}
+
+void loop() {}
@@ -0,0 +1,113 @@
+/* Reach out to almonds@mit.edu or jodalyst@mit.edu for help */
+
+#include <Six302.h>
+#include <atomic>
+
+/* Stress test for the snapshot group (a seqlock), host only
+
+   A second thread plays the user's loop on the other core. It updates a
+   position, a velocity and a command inside beginUpdate and endUpdate,
+   with some work between them, as fast as it can. Meanwhile steps record
+   the three, and every report is read back. Within a report, each sample
+   must come from a single update (velocity = 2 * position, command =
+   3 * position).
+
+   Run it on a computer with more than one core for true concurrency; on
+   one core it still checks what preemption mid-update does. With `make
+   check`, it exits with the number of torn samples. */
+
+#define STEP_TIME   200
+#define REPORT_TIME 2000
+#define SECONDS     5
+
+CommManager cm(STEP_TIME, REPORT_TIME);
+S302LoopbackTransport wire;
+
+volatile int32_t position;
+volatile float   velocity;
+volatile double  command;
+
+std::atomic<bool> done(false);
+
+void update() {
+   for( int32_t i = 1; !done; i++ ) {
+      cm.beginUpdate();
+      position = i;
+      for( volatile uint8_t k = 0; k < 20; k++ );
+      velocity = 2.0f * (i % 1000000); // (exact in a float)
+      for( volatile uint8_t k = 0; k < 20; k++ );
+      command = 3.0 * i;
+      cm.endUpdate();
+   }
+}
+
+/* Reports read back: "\fR", header, then count + samples per reporter */
+
+uint8_t  rx[1 << 14];
+uint16_t rx_len;
+uint32_t whole, torn;
+
+void check(const uint8_t* report) {
+   const uint8_t* p = report + 2 + 4 + 4 + 1;
+   int32_t pos[10]; float vel[10]; double cmd[10];
+   uint8_t n = *p++;
+   memcpy(pos, p, 4 * n); p += 4 * n;
+   uint8_t m = *p++;
+   memcpy(vel, p, 4 * m); p += 4 * m;
+   uint8_t o = *p++;
+   memcpy(cmd, p, 8 * o);
+   for( uint8_t k = 0; k < n && k < m && k < o; k++ ) {
+      if( !pos[k] )
+         continue; // (before the first update)
+      if( vel[k] == 2.0f * (pos[k] % 1000000) && cmd[k] == 3.0 * pos[k] )
+         whole++;
+      else
+         torn++;
+   }
+}
+
+void receive() {
+   rx_len += wire.drain(rx + rx_len, sizeof(rx) - rx_len);
+   uint16_t p = 0;
+   for(;;) {
+      while( p + 1 < rx_len && !(rx[p] == '\f' && rx[p + 1] == 'R') )
+         p++;
+      uint16_t q = p + 2 + 4 + 4 + 1;
+      for( uint8_t i = 0; i < 3 && q < rx_len; i++ )
+         q += 1 + (i == 2? 8 : 4) * rx[q]; // (the command is a double)
+      if( q + 2 > rx_len )
+         break;
+      check(rx + p);
+      p = q + 2;
+   }
+   memmove(rx, rx + p, rx_len - p);
+   rx_len -= p;
+}
+
+void setup() {
+   cm.addNumber(&position, "Position", 10);
+   cm.addNumber(&velocity, "Velocity", 10);
+   cm.addNumber(&command, "Command", 10);
+   cm.snapshot((const void*)&position);
+   cm.snapshot((const void*)&velocity);
+   cm.snapshot((const void*)&command);
+   cm.addTransport(wire);
+   cm.connect();
+
+   std::thread writer(update);
+   uint32_t start = millis();
+   while( millis() - start < SECONDS * 1000 ) {
+      cm.step();
+      receive();
+   }
+   done = true;
+   writer.join();
+
+   printf("%u cores: %lu whole samples, %lu torn\n",
+          std::thread::hardware_concurrency(),
+          (unsigned long)whole, (unsigned long)torn);
+   puts(torn || !whole? "FAIL" : "PASS");
+   exit(torn || !whole);
+}
+
+void loop() {}
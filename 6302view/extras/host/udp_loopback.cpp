@@ -0,0 +1,160 @@
+/* Reach out to almonds@mit.edu or jodalyst@mit.edu for help */
+
+#include <Six302.h>
+#define S302_UDP_LEN 512 // (room for a report, not for the long debug message)
+#include <S302Udp.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* The host's UDP path over localhost, host only
+
+   Reports go by UDP and everything else over a pty, as `local_server.py
+   --udp 127.0.0.1:PORT --serial PATH` would use them. This plays the
+   bridge: it subscribes with "S", asks over the pty for the build string,
+   sets the slider and pings, then for STEPS steps checks that
+
+      udp   each datagram is a sequence number, then exactly one report,
+            the sequence numbers counting up by one
+      pty   the build string and the ping's answer arrive, no reports do,
+            and the slider takes the value sent
+
+   Then a debug message longer than S302_UDP_LEN is sent (debug messages
+   go out the step after a report, in a datagram of their own): it must be
+   dropped, counted by `dropped`, and leave a gap of one in the sequence
+   numbers. With `make check`, it exits with the number of failures. */
+
+#define STEP_TIME   1000
+#define REPORT_TIME 10000
+#define STEPS       1000
+#define PORT        16303
+
+#define PLOTS 10
+#define BURST 10
+
+CommManager cm(STEP_TIME, REPORT_TIME);
+S302PtyTransport pty;
+S302UdpTransport<S302PosixUdp> udp(PORT);
+
+float values[PLOTS];
+float slider;
+
+int bridge = -1, peer = -1; // (the UDP socket, and the pty's other end)
+
+/* What arrives by UDP */
+
+uint32_t datagrams, reports, gaps, disorder, malformed, last_seq;
+
+void receive_udp() {
+   uint8_t d[2048];
+   ssize_t n;
+   while( (n = recv(bridge, d, sizeof(d), 0)) > 0 ) {
+      uint32_t seq;
+      memcpy(&seq, d, 4);
+      if( datagrams && seq != last_seq + 1 ) {
+         if( seq == last_seq + 2 )
+            gaps++;
+         else
+            disorder++;
+      }
+      last_seq = seq;
+      datagrams++;
+      // "\fR", header, then count + samples per plot, "\n\0"
+      ssize_t q = 4 + 2 + 4 + 4 + 1;
+      for( uint8_t i = 0; i < PLOTS && q < n; i++ )
+         q += 1 + 4 * d[q];
+      q += 2;
+      if( n < 6 || d[4] != '\f' || d[5] != 'R' || q != n ) {
+         malformed++;
+         continue;
+      }
+      reports++;
+   }
+}
+
+/* What arrives over the pty */
+
+uint8_t  pty_rx[1 << 14];
+uint16_t pty_len;
+
+void receive_pty() {
+   ssize_t n = read(peer, pty_rx + pty_len, sizeof(pty_rx) - pty_len);
+   if( n > 0 )
+      pty_len += n;
+}
+
+bool seen(const char* frame) {
+   for( uint16_t p = 0; p + 1 < pty_len; p++ )
+      if( pty_rx[p] == frame[0] && pty_rx[p + 1] == frame[1] )
+         return true;
+   return false;
+}
+
+void run(uint32_t steps) {
+   for( uint32_t i = 0; i < steps; i++ ) {
+      for( uint8_t k = 0; k < PLOTS; k++ )
+         values[k] = sin(i * 0.01 + k);
+      cm.step();
+      receive_udp();
+      receive_pty();
+   }
+}
+
+uint8_t failures;
+
+void expect(bool ok, const char* what) {
+   printf("   %s %s\n", ok? "ok   " : "FAIL ", what);
+   failures += !ok;
+}
+
+void setup() {
+   for( uint8_t k = 0; k < PLOTS; k++ )
+      cm.addPlot(&values[k], "Value", -1, 1, 10, BURST);
+   cm.addSlider(&slider, "Slider", 0, 1, 0.05);
+   if( !pty.begin() || !udp.begin() ) {
+      puts("can't open a pty or bind the port\nFAIL");
+      exit(1);
+   }
+   cm.addTransport(pty, S302_NO_REPORTS);
+   cm.addTransport(udp);
+   cm.connect();
+
+   /* The bridge's side */
+   peer = open(pty.path(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+   bridge = socket(AF_INET, SOCK_DGRAM, 0);
+   fcntl(bridge, F_SETFL, O_NONBLOCK);
+   sockaddr_in device = {};
+   device.sin_family = AF_INET;
+   device.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   device.sin_port = htons(PORT);
+   sendto(bridge, "S", 1, 0, (sockaddr*)&device, sizeof(device));
+   const char* asks = "\n0:0.75\nP1234\n";
+   write(peer, asks, strlen(asks));
+
+   /* Steady reports */
+   run(STEPS);
+   printf("%lu datagrams, %lu reports, %lu out of sequence, %lu malformed\n",
+          (unsigned long)datagrams, (unsigned long)reports,
+          (unsigned long)(gaps + disorder), (unsigned long)malformed);
+   expect(udp.subscribers() == 1, "subscribed");
+   expect(reports >= STEPS * STEP_TIME / REPORT_TIME * 9 / 10, "reports arrived");
+   expect(reports == datagrams && !malformed, "one report per datagram");
+   expect(!gaps && !disorder, "sequence numbers count up by one");
+   expect(seen("\fB") && seen("\fP") && !seen("\fR"), "pty carried the rest");
+   expect(slider == 0.75f, "slider set over the pty");
+
+   /* One report that doesn't fit */
+   char big[MAX_DEBUG_LEN];
+   memset(big, 'x', sizeof(big) - 10);
+   big[sizeof(big) - 10] = '\0';
+   cm.debug(big);
+   run(2 * REPORT_TIME / STEP_TIME);
+   printf("%lu dropped\n", (unsigned long)udp.dropped());
+   expect(udp.dropped() == 1, "oversize datagram dropped");
+   expect(gaps == 1 && !disorder && !malformed, "and left a gap of one");
+
+   puts(failures? "FAIL" : "PASS");
+   exit(failures);
+}
+
+void loop() {}
@@ -11,6 +11,8 @@ import sys
 import time
 import argparse
 import configparser
+import struct
+import math
 
 # ANSI color codes seem reasonably cross-platform?
 RED = "\033[91m"
@@ -178,6 +180,16 @@ def parse_args() -> argparse.Namespace:
     parser.add_argument(
         "-v", "--verbose", action="store_true",
         help="print up- and downstream bytes to console")
+    parser.add_argument(
+        "--ping", type=float, default=0, metavar="SECONDS",
+        help="probe the serial hop's latency this often (0: never)")
+    parser.add_argument(
+        "--udp", metavar="HOST[:PORT]",
+        help="also take reports by UDP from the device at HOST\n"
+             "(S302UdpTransport, port 6303 unless given)")
+    parser.add_argument(
+        "--serial", metavar="PATH",
+        help="use this serial device instead of looking for one")
     parser.add_argument(
         "-w", "--wizard",
         action="store_true",
@@ -192,6 +204,15 @@ def handle_preferences() -> Preferences:
     """
     preferences = Preferences()
     args = parse_args()
+    preferences.ping = args.ping
+    preferences.serial = args.serial
+    preferences.udp = None
+    if args.udp:
+        host, _, port = args.udp.partition(":")
+        if port and not port.isdigit():
+            print("Please give the UDP device as HOST or HOST:PORT.")
+            sys.exit(1)
+        preferences.udp = (host, int(port) if port else UDP_PORT)
 
     if not args.wizard:
         print(f"Run with {YELLOW}-w{RESET} flag to set preferences\n")
@@ -222,12 +243,189 @@ def handle_preferences() -> Preferences:
 
     return preferences
 
+class ClockSync:
+    """Latency probe and clock sync for the serial hop (bridge <-> device)
+
+    Sends "Pb<host us>\n" down. The device answers "\fP", its micros() when
+    the ping arrived and when the answer left (uint32 each), the token, and
+    "\n". The offsets (device - host) of the quickest recent round trips are
+    fitted against host time, giving the drift between the clocks. The GUI
+    does the same end to end (clock_sync.js) and ignores these answers, so
+    comparing the two splits the latency between the hops.
+    """
+    HIST_LEN = 12 # <0.5 ms, <1 ms, <2 ms ... <512 ms, more
+    WINDOW = 32
+
+    def __init__(self):
+        self.pending: typing.Dict[str, int] = {}
+        self.fits: typing.List[typing.Tuple[float, float, float]] = [] # host, offset, rtt
+        self.last_raw: typing.Optional[int] = None
+        self.last_device = 0
+        self.offset: typing.Optional[float] = None
+        self.drift = 0.0
+        self.hist = [0] * self.HIST_LEN
+        self.pongs = 0
+        self.tail = b""
+
+    @staticmethod
+    def now() -> int:
+        return time.perf_counter_ns() // 1000
+
+    def ping(self) -> bytes:
+        sent = self.now()
+        for token, t in list(self.pending.items()):
+            if sent - t > 5_000_000: del self.pending[token] # lost
+        token = f"b{sent}"
+        self.pending[token] = sent
+        return f"P{token}\n".encode("ascii")
+
+    def unwrap(self, raw: int) -> int:
+        """Device micros() wraps every 71 minutes"""
+        if self.last_raw is None:
+            self.last_device = raw
+        else:
+            self.last_device += (raw - self.last_raw + 2**31) % 2**32 - 2**31
+        self.last_raw = raw
+        return self.last_device
+
+    def bucket(self, us: float) -> int:
+        ms = us / 1000
+        if ms < 0.5: return 0
+        return min(self.HIST_LEN - 1, math.floor(math.log2(ms)) + 2)
+
+    def pong(self, token: str, arrived: int, left: int) -> None:
+        back = self.now()
+        sent = self.pending.pop(token, None)
+        if sent is None: return
+        held = (left - arrived) % 2**32
+        arrived = self.unwrap(arrived)
+        left = arrived + held
+        rtt = (back - sent) - (left - arrived)
+        self.fits.append(((sent + back) / 2, ((arrived - sent) + (left - back)) / 2, rtt))
+        self.fits = self.fits[-self.WINDOW:]
+        self.fit()
+        self.hist[self.bucket(rtt)] += 1
+        self.pongs += 1
+        if self.pongs % 10 == 0: print(self.summary())
+
+    def fit(self) -> None:
+        best = min(f[2] for f in self.fits)
+        use = [f for f in self.fits if f[2] <= 1.5 * best + 100]
+        xm = sum(f[0] for f in use) / len(use)
+        ym = sum(f[1] for f in use) / len(use)
+        sxx = sum((f[0] - xm) ** 2 for f in use)
+        sxy = sum((f[0] - xm) * (f[1] - ym) for f in use)
+        self.offset = ym
+        self.drift = sxy / sxx if sxx > 0 else 0.0
+
+    def feed(self, data: bytes) -> None:
+        """Picks the answers to our pings out of the serial stream"""
+        buf = self.tail + data
+        self.tail = buf[-1:] # (a "\f" whose "P" is yet to come)
+        i = buf.find(b"\fP")
+        while i >= 0:
+            end = buf.find(b"\n", i + 10)
+            if end < 0:
+                self.tail = buf[i:i + 64] # wait for the rest
+                break
+            token = buf[i + 10:end]
+            if token.startswith(b"b"):
+                arrived, left = struct.unpack("<II", buf[i + 2:i + 10])
+                self.pong(token.decode("ascii", "replace"), arrived, left)
+            i = buf.find(b"\fP", i + 2)
+
+    def summary(self) -> str:
+        rtts = sorted(f[2] for f in self.fits)
+        edges = ["<0.5"] + [f"<{2 ** (i - 1)}" for i in range(1, self.HIST_LEN - 1)] \
+              + [f">={2 ** (self.HIST_LEN - 3)}"]
+        hist = " ".join(f"{e}:{n}" for e, n in zip(edges, self.hist))
+        return (
+            f"{BLUE}[serial hop]{RESET} round trip min {rtts[0] / 1000:.2f} ms, "
+            f"median {rtts[len(rtts) // 2] / 1000:.2f} ms; "
+            f"offset {self.offset:.0f} us, drift {self.drift * 1e6:.1f} ppm\n"
+            f"   round trips (ms) {hist}"
+        )
+
+UDP_PORT = 6303 # S302_UDP_PORT
+
+class Telemetry(asyncio.DatagramProtocol):
+    """Reports by UDP (S302UdpTransport), passed on to the pages
+
+    Keeps the device sending by subscribing ("S") every second. Each
+    datagram is a sequence number (uint32, little-endian), then a step's
+    frames. Late or repeated datagrams are dropped, as is a datagram for a
+    page still busy with the last one: a stale report is of no use.
+    """
+    KEEPALIVE = 1.0  # seconds between subscribes
+    RESYNC = 8       # late datagrams in a row that mean the device restarted
+
+    def __init__(self, device: typing.Tuple[str, int], verbose: bool):
+        self.device = device
+        self.verbose = verbose
+        self.transport: typing.Optional[asyncio.DatagramTransport] = None
+        self.pages: typing.Dict[typing.Any, typing.Optional[asyncio.Future]] = {}
+        self.last_seq: typing.Optional[int] = None
+        self.late_run = 0
+        self.received = self.lost = self.late = self.skipped = 0
+
+    def connection_made(self, transport):
+        self.transport = transport
+
+    def datagram_received(self, data: bytes, addr) -> None:
+        if len(data) < 4: return
+        seq = struct.unpack("<I", data[:4])[0]
+        if self.last_seq is not None:
+            ahead = (seq - self.last_seq) % 2**32
+            if ahead == 0 or ahead >= 2**31:
+                self.late += 1
+                self.late_run += 1
+                if self.late_run < self.RESYNC: return
+                ahead = 1
+            self.lost += ahead - 1
+        self.last_seq = seq
+        self.late_run = 0
+        self.received += 1
+        if self.verbose: print("△", seq, data[4:])
+        for page, sending in self.pages.items():
+            if sending is not None and not sending.done():
+                self.skipped += 1
+                continue
+            self.pages[page] = asyncio.ensure_future(page.send(data[4:]))
+
+    def error_received(self, exc) -> None:
+        if self.verbose: print(f"udp: {RED}{exc}{RESET}")
+
+    async def subscribe(self) -> None:
+        """Keeps the device sending, and says how it's going now and then"""
+        ticks = 0
+        while True:
+            if self.transport: self.transport.sendto(b"S", self.device)
+            ticks += 1
+            if ticks % 10 == 0 and self.received: print(self.summary())
+            await asyncio.sleep(self.KEEPALIVE)
+
+    async def serve(self, websocket) -> None:
+        """Sends a page the reports, until it goes"""
+        self.pages[websocket] = None
+        try:
+            await websocket.wait_closed()
+        finally:
+            del self.pages[websocket]
+
+    def summary(self) -> str:
+        return (
+            f"{BLUE}[udp]{RESET} {self.received} datagrams, {self.lost} lost, "
+            f"{self.late} late, {self.skipped} skipped for busy pages"
+        )
+
 class Handler:
     """Handles communication between the microcontroller and the WebSockets server
     """
     def __init__(self, preferences: Preferences):
         self.preferences = preferences
         self.serial = self.connect_serial()
+        self.clock = ClockSync()
+        self.telemetry: typing.Optional[Telemetry] = None
 
     @property
     def connected(self) -> bool:
@@ -290,9 +488,9 @@ class Handler:
         return port.device
 
     def connect_serial(self) -> serial.Serial:
-        """Connects to the device found by `get_usb_port()`
+        """Connects to the device found by `get_usb_port()`, or `--serial`
         """
-        device = self.get_usb_port()
+        device = self.preferences.serial or self.get_usb_port()
         if device is None:
             #print("I couldn't find your USB-Serial controller D:")
             print((
@@ -354,6 +552,9 @@ class Handler:
                 self.serial.close()
                 await asyncio.sleep(1)
 
+            # note answers to our own pings (they go up to the page anyway)
+            if self.preferences.ping and data: self.clock.feed(data)
+
             # send message to websocket
             try:
                 if self.preferences.verbose and data != b"": print("▲", data)
@@ -364,16 +565,39 @@ class Handler:
                 print(e)
                 break
 
+    async def pinger(self):
+        """Probes the serial hop every `--ping` seconds
+        """
+        while True:
+            await asyncio.sleep(self.preferences.ping)
+            if not self.connected: continue
+            try:
+                self.serial.write(self.clock.ping())
+            except KeyboardInterrupt:
+                raise
+            except Exception as e:
+                print(f"failing on ping: {RED}{e}{RESET}")
+
     async def handler(self, websocket):
         """Handles communication between the websocket and the microcontroller
         """
+        # (websockets 10+ keeps the path on the request)
+        path = getattr(websocket, "path", None) or websocket.request.path
+        if path == "/udp":
+            if self.telemetry: await self.telemetry.serve(websocket)
+            return
+
         if not self.connected: self.connect_serial()
+        if self.telemetry: await websocket.send("udp") # (reports come that way)
 
         page_to_mcu = asyncio.ensure_future(self.downlink(websocket))
         mcu_to_page = asyncio.ensure_future(self.uplink(websocket))
+        tasks = [page_to_mcu, mcu_to_page]
+        if self.preferences.ping:
+            tasks.append(asyncio.ensure_future(self.pinger()))
 
         done, pending = await asyncio.wait(
-            [page_to_mcu, mcu_to_page],
+            tasks,
             return_when=asyncio.FIRST_COMPLETED
         )
         for task in pending: task.cancel()
@@ -384,6 +608,12 @@ class Handler:
         `self.handler` handles incoming websocket connections
         """
         async def main():
+            if self.preferences.udp:
+                self.telemetry = Telemetry(self.preferences.udp, self.preferences.verbose)
+                await asyncio.get_running_loop().create_datagram_endpoint(
+                    lambda: self.telemetry, local_addr=("0.0.0.0", 0))
+                keepalive = asyncio.ensure_future(self.telemetry.subscribe())
+                print(f"Taking reports by UDP from {BLUE}{self.preferences.udp[0]}:{self.preferences.udp[1]}{RESET}\n")
             serve = websockets.serve # type: ignore
             server = serve(self.handler, "127.0.0.1", self.preferences.port)
             async with server: await asyncio.Future()
@@ -0,0 +1,117 @@
+// Round-trip latency probe and host/device clock sync.
+//
+// Each ping carries the host's time (us) as its token. The device answers
+// "\fP", its micros() when the ping arrived and when the answer left
+// (uint32 each), the token back, then "\n". From those four times:
+//
+//   round trip = (back - sent) - (left - arrived)
+//   offset     = ((arrived - sent) + (left - back)) / 2   (device - host)
+//
+// The offsets of the quickest recent round trips are fitted against host
+// time, so the slope is the drift between the two clocks, and device times
+// (e.g. when a report began) can be turned into host times.
+var CLOCK_HIST_LEN = 12; // <0.5 ms, <1 ms, <2 ms ... <512 ms, more
+
+function Clock_Sync(window_len=32){
+    var pending = {};   // host time sent, by token
+    var fits = [];      // {host, offset, rtt} of the last pings
+    var last_raw = null, last_device = 0; // to unwrap micros()
+    var a = null, b = 0, xm = 0; // offset = a + b*(host - xm)
+    var rtt_hist = new Array(CLOCK_HIST_LEN).fill(0);
+    var age_hist = new Array(CLOCK_HIST_LEN).fill(0);
+    var pongs = 0;
+
+    var now = function(){ return performance.now()*1000; }
+
+    // (device micros() wraps every 71 minutes)
+    var unwrap = function(raw){
+        if (last_raw === null) last_device = raw;
+        else last_device += (raw - last_raw) | 0;
+        last_raw = raw;
+        return last_device;
+    }
+
+    var bucket = function(us){
+        var ms = us/1000;
+        if (ms < 0.5) return 0;
+        return Math.min(CLOCK_HIST_LEN-1, Math.floor(Math.log2(ms)) + 2);
+    }
+
+    var fit = function(){
+        var best = Math.min.apply(null, fits.map(function(f){ return f.rtt; }));
+        var use = fits.filter(function(f){ return f.rtt <= 1.5*best + 100; });
+        var n = use.length;
+        xm = use.reduce(function(s, f){ return s + f.host; }, 0) / n;
+        var ym = use.reduce(function(s, f){ return s + f.offset; }, 0) / n;
+        var sxx = 0, sxy = 0;
+        for (var f of use){
+            sxx += (f.host - xm)*(f.host - xm);
+            sxy += (f.host - xm)*(f.offset - ym);
+        }
+        a = ym;
+        b = sxx > 0? sxy/sxx : 0;
+    }
+
+    this.synced = function(){ return a !== null; }
+
+    // Message to send down, e.g. "P123456789\n"
+    this.ping = function(){
+        var sent = Math.round(now());
+        for (var token in pending)
+            if (sent - pending[token] > 5e6) delete pending[token]; // lost
+        pending[sent] = sent;
+        return "P" + sent + "\n";
+    }
+
+    // Take an answer. Tokens we didn't send (the bridge's own pings) or
+    // have already seen are ignored.
+    this.pong = function(token, arrived, left){
+        var back = now();
+        if (!(token in pending)) return false;
+        var sent = pending[token];
+        delete pending[token];
+        var held = (left - arrived) >>> 0;
+        arrived = unwrap(arrived);
+        left = arrived + held;
+        var rtt = (back - sent) - (left - arrived);
+        fits.push({host: (sent + back)/2,
+                   offset: ((arrived - sent) + (left - back))/2,
+                   rtt: rtt});
+        if (fits.length > window_len) fits.shift();
+        fit();
+        rtt_hist[bucket(rtt)]++;
+        if (++pongs % 10 == 0) console.log(this.summary());
+        return true;
+    }
+
+    // Host time (us, as performance.now) of a device time (micros())
+    this.toHost = function(device){
+        if (a === null) return null;
+        device = unwrap(device);
+        var host = device - a;
+        return device - (a + b*(host - xm));
+    }
+
+    // Host time a report began, noting how old its last sample is by now
+    this.stamp = function(base, period){
+        var start = this.toHost(base);
+        if (start !== null) age_hist[bucket(now() - (start + period))]++;
+        return start;
+    }
+
+    this.summary = function(){
+        var rtts = fits.map(function(f){ return f.rtt; }).sort(function(x, y){ return x - y; });
+        var edges = ["<0.5"];
+        for (var i = 1; i < CLOCK_HIST_LEN-1; i++) edges.push("<" + Math.pow(2, i-1));
+        edges.push(">=" + Math.pow(2, CLOCK_HIST_LEN-3));
+        var hist = function(h){
+            return edges.map(function(e, i){ return e + ":" + h[i]; }).join(" ");
+        }
+        return `[clock] round trip min ${(rtts[0]/1000).toFixed(2)} ms, ` +
+               `median ${(rtts[rtts.length >> 1]/1000).toFixed(2)} ms; ` +
+               `offset ${a === null? "?" : a.toFixed(0)} us, ` +
+               `drift ${(b*1e6).toFixed(1)} ppm\n` +
+               `\tround trips (ms) ${hist(rtt_hist)}\n` +
+               `\tage of reports when drawn (ms) ${hist(age_hist)}`;
+    }
+};
@@ -45,6 +45,7 @@ var unique_counter = 0;
 var displayers = []; //array of hooks for plot and numerical reporter objects
 var report_count = []; //total number of displays (will have length of modules)
 var report_depth = []; //depth of displays
+var report_types = []; //sample type of displays (float, int16, bool, ...)
 
 var old_input = [];
 
@@ -52,6 +53,12 @@ var input_uniques = [];
 var current_inputs = [];
 
 var ws;
+var ws_udp = null;      // reports by UDP, through the bridge
+
+var capture = null;     // flight recorder download in progress
+var clock = null;       // host/device clock sync (see clock_sync.js)
+var ping_timer = null;
+var PING_PERIOD = 1000; // ms between latency probes
 
 var gui_land = document.getElementById("gui_land"); //where draggables end up!
 
@@ -91,9 +98,11 @@ window.onload = function(){
     // Web Socket is connected, send data using send()
       console.log("web socket established");
       ws.send("\n"); 
+      startPings();
     }; 
     ws.onmessage = function (evt) {
-        MessageParser(evt);
+        if (evt.data === "udp") openTelemetry();
+        else MessageParser(evt);
     };
 
     ws.onclose = function(){ 
@@ -104,6 +113,25 @@ window.onload = function(){
     document.addEventListener("ui_change", inputEmit);
 }
 
+var startPings = function(){
+    clock = new Clock_Sync();
+    clearInterval(ping_timer);
+    ping_timer = setInterval(function(){
+        if (ws.readyState == 1) ws.send(clock.ping());
+    }, PING_PERIOD);
+}
+
+// The bridge (local_server.py --udp) says reports come by UDP: take
+// them, one datagram per message, from its telemetry socket
+var openTelemetry = function(){
+    if (ws_udp) ws_udp.close();
+    ws_udp = new WebSocket(ws.url.replace(/\/$/, "") + "/udp");
+    ws_udp.binaryType = "arraybuffer";
+    ws_udp.onmessage = function (evt) {
+        MessageParser(evt, true);
+    };
+}
+
 var inputEmit = function(e){
     var t = e.detail["message"];
     console.log(t);
@@ -127,9 +155,11 @@ document.getElementById("ipportsubmit").addEventListener("mousedown",function(){
     // Web Socket is connected, send data using send()
      ws.send("\n"); 
       //ws.send(buf); 
+     startPings();
     }; 
     ws.onmessage = function (evt) {
-        MessageParser(evt);
+        if (evt.data === "udp") openTelemetry();
+        else MessageParser(evt);
     };
 
     ws.onclose = function(){ ///some sort of scope issue
@@ -139,6 +169,74 @@ document.getElementById("ipportsubmit").addEventListener("mousedown",function(){
 });
 
 
+document.getElementById("capture_download").addEventListener("mousedown",function(){
+    capture = {bytes: new Uint8Array(0), resumed: 0};
+    ws.send("F\n");
+});
+
+// Take one page of a capture download. Pages must come in order; after a
+// gap, ask again from where it broke.
+var takeCapture = function(pos, page) {
+    if (capture == null) return;
+    var have = capture.bytes.length;
+    if (pos != have) {
+        if (pos > have && capture.resumed != have) {
+            capture.resumed = have;
+            ws.send("F" + String(have) + "\n");
+        }
+        return;
+    }
+    if (page.length == 0) { // the end
+        exportCapture(capture.bytes);
+        capture = null;
+        return;
+    }
+    var merged = new Uint8Array(have + page.length);
+    merged.set(capture.bytes);
+    merged.set(page, have);
+    capture.bytes = merged;
+}
+
+// A capture is "S302", the step period (uint32), how many reporters
+// (uint8), the type (uint8) and title ("\0" ended) of each, then records of
+// micros() (uint32) and the reporters' values at their own widths.
+var captureTypes = {0x01: "int8", 0x02: "int16", 0x04: "int32", 0x08: "int64",
+                    0x11: "uint8", 0x12: "uint16", 0x14: "uint32", 0x18: "uint64",
+                    0x24: "float", 0x28: "double", 0x31: "uint8"}; // (bools whole)
+
+var exportCapture = function(bytes) {
+    if (bytes.length < 9 || String.fromCharCode.apply(null, bytes.slice(0, 4)) != "S302") {
+        console.log("[capture] nothing recorded");
+        return;
+    }
+    var view = new DataView(bytes.buffer);
+    var n = bytes[8];
+    var headers = ["device_us"];
+    var types = [];
+    var size = 4;
+    var pos = 9;
+    for (var i = 0; i < n; i++) {
+        var end = bytes.indexOf(0, pos + 1);
+        types.push(captureTypes[bytes[pos]]);
+        size += bytes[pos] & 0x0F;
+        headers.push(String.fromCharCode.apply(null, bytes.slice(pos + 1, end)));
+        pos = end + 1;
+    }
+    var rows = [];
+    for (; pos + size <= bytes.length; pos += size) {
+        var row = [view.getUint32(pos, true)];
+        for (var at = pos + 4, i = 0; i < n; i++) {
+            row.push(readSample(view, bytes, at, types[i], 0));
+            at += type_widths[types[i]];
+        }
+        rows.push(row);
+    }
+    var nameo = document.getElementById("csv_name").value;
+    nameo += nameo.length == 0? "" : "_"
+    nameo += "capture_" + String(Date.now()) + ".csv";
+    exportCSV(nameo, headers, rows);
+}
+
 document.getElementById("csv_enable").addEventListener("change",function() {
     if (document.getElementById("csv_enable").checked){
         csv_record = true;
@@ -230,13 +328,129 @@ var isDataStrt = function(e,index,dataArr) {
 var isDbgStrt = function(e,index,dataArr) {
     return((e == 12) && (dataArr[index+1] == 68));
 }
+// Find capture page in Uint8Array, the "\fF" character pair.
+var isPageStrt = function(e,index,dataArr) {
+    return((e == 12) && (dataArr[index+1] == 70));
+}
+// Find ping answer in Uint8Array, the "\fP" character pair.
+var isPongStrt = function(e,index,dataArr) {
+    return((e == 12) && (dataArr[index+1] == 80));
+}
 
 var tDataSave = new ArrayBuffer(4);
 var plot_buffer = [];
+var sample_dt = [];   // time between plotted samples, per reporter (us)
+var sample_debt = []; // time not yet plotted, per reporter (us)
+
+var sample_held = []; // last value of change-only reporters
+
+// Bytes per sample of each reporter type (bools are packed, 8 to a byte)
+var type_widths = {int8: 1, uint8: 1, int16: 2, uint16: 2, int32: 4, uint32: 4,
+                   int64: 8, uint64: 8, float: 4, double: 8, int: 4};
+
+var blockSize = function(type, count) {
+    if (type === "bool") return Math.ceil(count / 8);
+    return count * (type_widths[type] || 4);
+}
+
+var readSample = function(view, bytes, pos, type, k) {
+    switch (type) {
+        case "bool": return (bytes[pos + (k >> 3)] >> (k & 7)) & 1;
+        case "int8": return view.getInt8(pos + k);
+        case "uint8": return view.getUint8(pos + k);
+        case "int16": return view.getInt16(pos + 2*k, true);
+        case "uint16": return view.getUint16(pos + 2*k, true);
+        case "int": case "int32": return view.getInt32(pos + 4*k, true);
+        case "uint32": return view.getUint32(pos + 4*k, true);
+        case "int64": return Number(view.getBigInt64(pos + 8*k, true));
+        case "uint64": return Number(view.getBigUint64(pos + 8*k, true));
+        case "double": return view.getFloat64(pos + 8*k, true);
+        default: return view.getFloat32(pos + 4*k, true);
+    }
+}
+
+// Parse one report frame starting just after its "\fR": the report period
+// (uint32, microseconds), the device time it began (uint32, microseconds),
+// the unit of sample times (uint8, as a power of two microseconds), then
+// for each reporter a count byte followed by that many samples of its type
+// (see blockSize). If the count's top bit is set, the samples are preceded
+// by their uint16 times since the report began. Returns null if the frame
+// isn't all here yet.
+var parseReport = function(tData, tDataB, pos) {
+    var view = new DataView(tData);
+    if (pos + 9 > tDataB.length) return null;
+    var period = view.getUint32(pos, true);
+    var base = view.getUint32(pos+4, true);
+    var shift = tDataB[pos+8];
+    pos += 9;
+    var samples = [];
+    var times = [];
+    for (var i = 0; i < displayers.length; i++) {
+        if (pos + 1 > tDataB.length) return null;
+        var count = tDataB[pos] & 0x7F;
+        var stamped = (tDataB[pos] & 0x80) != 0;
+        pos += 1;
+        var t = null;
+        if (stamped) {
+            if (pos + 2*count > tDataB.length) return null;
+            t = [];
+            for (var k = 0; k < count; k++) {
+                t.push(view.getUint16(pos, true) * Math.pow(2, shift));
+                pos += 2;
+            }
+        }
+        var size = blockSize(report_types[i], count);
+        if (pos + size > tDataB.length) return null;
+        var s = [];
+        for (var k = 0; k < count; k++)
+            s.push(readSample(view, tDataB, pos, report_types[i], k));
+        pos += size;
+        samples.push(s);
+        times.push(t);
+    }
+    if (pos >= tDataB.length) return null;
+    return {end: pos, ok: tDataB[pos] == 10, period: period, base: base,
+            samples: samples, times: times};
+}
+
+// The device may change how many samples it sends per report, and how
+// often (adaptive rate). Hold or skip samples so each plot keeps the time
+// spacing it started with.
+var rescale = function(i, samples, period) {
+    if (samples.length == 0) return [];
+    var dt = period / samples.length;
+    if (!sample_dt[i]) sample_dt[i] = dt;
+    var out = [];
+    for (var k = 0; k < samples.length; k++) {
+        sample_debt[i] += dt;
+        while (sample_debt[i] >= sample_dt[i]) {
+            out.push(samples[k]);
+            sample_debt[i] -= sample_dt[i];
+        }
+    }
+    return out;
+}
+
+// Change-only reporters send samples with their own times instead. Hold
+// each one until the next, on the same time spacing as above.
+var place = function(i, times, samples, period) {
+    if (!sample_dt[i]) sample_dt[i] = period / Math.max(1, report_depth[i]);
+    var out = [];
+    var k = 0;
+    var t = sample_dt[i] - sample_debt[i]; // next plotted point
+    for (; t < period; t += sample_dt[i]) {
+        while (k < times.length && times[k] <= t) sample_held[i] = samples[k++];
+        if (sample_held[i] !== undefined) out.push(sample_held[i]);
+    }
+    while (k < times.length) sample_held[i] = samples[k++];
+    sample_debt[i] = period - t + sample_dt[i];
+    return out;
+}
 
-var MessageParser = function(evt) {
+var MessageParser = function(evt, datagram=false) {
     // Merge new packet with what's left of the last packet, and make int view
-    var tData = mergeArrBuf(tDataSave, evt.data);
+    // (a datagram stands alone, it has no leftovers and leaves none)
+    var tData = datagram? evt.data : mergeArrBuf(tDataSave, evt.data);
     var tDataB = new Uint8Array(tData);  // Need Int view for comparison
     //console.log(tDataB);
     var startNext = 0;
@@ -254,10 +468,14 @@ var MessageParser = function(evt) {
             var msgSize = endInd - msgStart+1;
             MPBuild(tDataB.slice(msgStart,msgStart+msgSize));
             plot_buffer = [];
+            sample_dt = [];
+            sample_debt = [];
+            sample_held = [];
             for (let i = 0; i < displayers.length; i++) {
-                for (let j = 0; j < report_count[i];j++) {
-                plot_buffer.push([])
-                }
+                plot_buffer.push([]);
+                sample_dt.push(0);
+                sample_debt.push(0);
+                sample_held.push(undefined);
             }
         }
     }
@@ -280,34 +498,73 @@ var MessageParser = function(evt) {
             console.log(`[${headroom}]\n\t${debugMsg}`);
         }
     }
+    // If packet has answers to pings, \fP's, hand them to the clock. (They
+    // may come round again with the leftovers, the clock ignores repeats.)
+    var pongInd = tDataB.findIndex(isPongStrt);
+    while (clock && pongInd >= 0) {
+        var endInd = tDataB.indexOf(10, pongInd + 10);
+        if (endInd < 0) break; // wait for the rest
+        var view = new DataView(tData);
+        var token = String.fromCharCode.apply(null, tDataB.slice(pongInd + 10, endInd));
+        clock.pong(token, view.getUint32(pongInd + 2, true),
+                          view.getUint32(pongInd + 6, true));
+        var found = tDataB.slice(pongInd + 2).findIndex(isPongStrt);
+        pongInd = found < 0? -1 : pongInd + 2 + found;
+    }
+    // If packet has flight recorder pages, \fF's, collect them. (Pages may
+    // come round again with the leftovers too, takeCapture skips them.)
+    var pageInd = tDataB.findIndex(isPageStrt);
+    while (capture && pageInd >= 0) {
+        if (pageInd + 8 > tDataB.length) break; // wait for the rest
+        var view = new DataView(tData);
+        var len = view.getUint16(pageInd + 6, true);
+        if (pageInd + 8 + len >= tDataB.length) break;
+        if (tDataB[pageInd + 8 + len] == 10)
+            takeCapture(view.getUint32(pageInd + 2, true),
+                        tDataB.slice(pageInd + 8, pageInd + 8 + len));
+        var found = tDataB.slice(pageInd + 2).findIndex(isPageStrt);
+        pageInd = found < 0? -1 : pageInd + 2 + found;
+    }
     // If packet has data strings, \fR's, find all complete ones and send.
-    if((plot_buffer != []) && (plot_buffer.length > 0)) {  // Data String!
+    if (plot_buffer.length > 0) {  // Data String!
         var pltPts = false;
-        var msgSz = 4*plot_buffer.length;
         while(true) {
-            startInd = startNext+tDataB.slice(startNext).findIndex(isDataStrt);
-            if (startInd >= 0) {
-                startNext = startInd;
-                let msgSt = startInd + 2;
-                let msgEnd = msgSt + msgSz;
-                if (tDataB[msgEnd] == 10) { // Ends in \n, Full frame!
-                    startNext = msgEnd;
-                    fData = new Float32Array(tData.slice(msgSt,msgEnd));
-                    var temp = Array.prototype.slice.call(fData);
-                    if(csv_record && (csv_rows.length < MAX_CSV_BUFFER)) {
-                        //console.log(current_inputs+Array.prototype.slice.call(fData));
-                        csv_rows.push(current_inputs.concat(temp)); // Record for CSV
-                    }
-                    pltPts = true;
-                    for(let i = 0; i < plot_buffer.length;  i++) {
-                        plot_buffer[i].push(fData[i]);
+            var found = tDataB.slice(startNext).findIndex(isDataStrt);
+            if (found < 0) break;
+            startInd = startNext + found;
+            startNext = startInd;
+            var frame = parseReport(tData, tDataB, startInd + 2);
+            if (frame == null) break; // wait for the rest
+            if (!frame.ok) { // not a report after all, keep looking
+                startNext = startInd + 2;
+                continue;
+            }
+            startNext = frame.end;
+            var start = clock? clock.stamp(frame.base, frame.period) : null;
+            var most = 0;
+            for (let i = 0; i < plot_buffer.length; i++) {
+                var s = frame.times[i] == null
+                    ? rescale(i, frame.samples[i], frame.period)
+                    : place(i, frame.times[i], frame.samples[i], frame.period);
+                plot_buffer[i] = plot_buffer[i].concat(s);
+                most = Math.max(most, frame.samples[i].length);
+            }
+            if(csv_record && (csv_rows.length < MAX_CSV_BUFFER)) {
+                // One row per sample of the busiest reporter
+                for (let k = 0; k < most; k++) {
+                    var row = [];
+                    for (let i = 0; i < frame.samples.length; i++) {
+                        var s = frame.samples[i];
+                        if (s.length) row.push(s[Math.floor(k*s.length/most)]);
+                        else if (sample_held[i] !== undefined) row.push(sample_held[i]);
+                        else row.push("");
                     }
-                } else{
-                    break;
+                    // (when the sample was taken, host ms since page load)
+                    row.push(start === null? "" : ((start + k*frame.period/most)/1000).toFixed(3));
+                    csv_rows.push(current_inputs.concat(row)); // Record for CSV
                 }
-            } else {
-                break;
             }
+            pltPts = true;
         }
         if (pltPts) {  // Plot and clear buffer
             MPData(plot_buffer);
@@ -318,6 +575,7 @@ var MessageParser = function(evt) {
     }
 
     // Save any leftovers for next time
+    if (datagram) return;
     if(tDataSave.byteLength > MAX_DATA_BUFFER) { // Buffer blown, reset hard.
         tDataSave = new ArrayBuffer(4);
     } else {
@@ -326,15 +584,11 @@ var MessageParser = function(evt) {
 };
 
 function MPData(fa) {
-    var data_count = 0;
+    // (reporters only record their first trace)
     for (var i = 0; i < displayers.length; i++){
-        var data = [];
-        for (var j = 0; j < report_count[i];j++){
+        var data = [fa[i].slice()];
+        for (var j = 1; j < report_count[i];j++){
             data.push([]);
-            for (var k = 0; k < fa[data_count].length; k++) {
-                data[j].push(fa[data_count][k]);
-            }
-        data_count+=1;
         }
         displayers[i].step(data);
     }
@@ -347,6 +601,8 @@ function MPBuild(intData) {
     csv_rows = [];
     displayers = [];
     report_count = [];
+    report_depth = [];
+    report_types = [];
     unique_counter = 0;
     current_inputs = [];
     input_uniques = [];
@@ -415,6 +671,7 @@ function MPBuild(intData) {
                 var trace_count = parseFloat(build_array[i+6]);
                 report_count.push(trace_count);
                 report_depth.push(trace_depth);
+                report_types.push(build_array[i+7]);
                 if (trace_count ===1){
                     displayers.push(new Time_Series(unique_counter,title,PLOT_WIDTH,PLOT_HEIGHT,h_count,[v_low,v_high],1,[standard_colors[0]]));
                     csv_col_headers.push(title);
@@ -423,7 +680,7 @@ function MPBuild(intData) {
                     displayers.push(new Time_Series(unique_counter,title,PLOT_WIDTH,PLOT_HEIGHT,h_count,[v_low,v_high],trace_count,colors));
                     for (var j = 0; j<trace_count;j++) csv_col_headers.push(title+"_"+String(j));
                 }
-                i+=7;
+                i+=8;
                 break;
             case "N": //numerical reporter:
                 console.log("building numerical reporter");
@@ -432,6 +689,7 @@ function MPBuild(intData) {
                 var type = build_array[i+3];
                 report_count.push(1);
                 report_depth.push(depth);
+                report_types.push(type);
                 displayers.push(new Numerical_Reporter(unique_counter,title,type));
                 csv_col_headers.push(title);
                 i+=4;
@@ -452,6 +710,7 @@ function MPBuild(intData) {
         }
         unique_counter += 1;
     }
+    csv_col_headers.push("host_ms");
     document.dispatchEvent(field_built);
 };
 
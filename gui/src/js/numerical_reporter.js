@@ -3,21 +3,18 @@ function Numerical_Reporter(unique,title,data_type,color=null,bg_color=null){
     var color = color;
     var bg_color = bg_color;
     var title = title;
-    var data_type = data_type; //int or float
+    var data_type = data_type; //float, double, bool, int8 ... uint64
     var range = [null,null]; //shape is : [low,high]..saturate otherwise
     var value = 0.0;
     var unique = unique; //unique identifying number
 
     var format = function(value){
-        var buffer = new ArrayBuffer(4);
-        var f32 = new Float32Array(buffer); 
-        var i32 = new Int32Array(buffer); 
-        f32[0] = value;
-        //console.log(data_type);
-        if (data_type==="float"){
-            return f32[0].toPrecision(12);
+        if (data_type==="float" || data_type==="double"){
+            return value.toPrecision(data_type==="float"? 7 : 15);
+        } else if (data_type==="bool"){
+            return value? "true" : "false";
         } else{
-            return i32[0];
+            return String(value);
         }
 
     }
@@ -38,12 +35,14 @@ function Numerical_Reporter(unique,title,data_type,color=null,bg_color=null){
     reported.innerHTML = format(value);
     holder.appendChild(reported);
     this.step = function(value){ 
-        if (range[1] != null && value[0][0]> range[1]){
-            value[0][0] = range[1];
-        }else if (range[0] != null && value[0][0] <range[0]){
-            value[0][0]= range[0];
+        if (value[0].length == 0) return;
+        var latest = value[0][value[0].length-1];
+        if (range[1] != null && latest > range[1]){
+            latest = range[1];
+        }else if (range[0] != null && latest < range[0]){
+            latest = range[0];
         }
-        // console.log(value[0][0]);
-        reported.innerHTML = format(value[0][0])
+        // console.log(latest);
+        reported.innerHTML = format(latest)
     };
 };